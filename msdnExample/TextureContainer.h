@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Baked texture container shared by the viewer and the texconv tool. A header and a level table
+// are followed by the level data, finest level first, each level 16-byte aligned so it can be
+// handed to the GL straight from a mapping. Rows are bottom-up like in a bitmap.
+namespace TextureContainer
+{
+
+enum class Format : uint32_t { BGRA8 = 0, BC1 = 1 };
+
+enum Flags : uint32_t { HasAlpha = 1 };
+
+struct Header
+{
+   char magic[4];
+   uint32_t version;
+   Format format;
+   uint32_t flags;
+   uint32_t width;
+   uint32_t height;
+   uint32_t levels;
+   uint32_t reserved;
+};
+
+struct Level
+{
+   uint32_t width;
+   uint32_t height;
+   uint32_t offset;
+   uint32_t size;
+};
+
+constexpr char magic[4]{'G', 'L', 'T', 'C'};
+constexpr uint32_t version = 1;
+
+inline bool IsContainer(const char* data, size_t size)
+{
+   return size >= sizeof(Header) && std::memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+// In 64 bits, so that no width and height from a file can wrap it round to a size that matches.
+inline uint64_t LevelSize(Format format, uint32_t width, uint32_t height)
+{
+   if (format == Format::BC1)
+      return (std::max)(uint64_t(1), (uint64_t(width) + 3) / 4) * (std::max)(uint64_t(1), (uint64_t(height) + 3) / 4) * 8;
+   return uint64_t(width) * height * 4;
+}
+
+// Tightly packed bottom-up BGRA pixels.
+struct Image
+{
+   uint32_t width = 0;
+   uint32_t height = 0;
+   std::vector<uint8_t> pixels;
+
+   const uint8_t* At(uint32_t x, uint32_t y) const { return &pixels[(size_t(y) * width + x) * 4]; }
+};
+
+// 2x2 box filter; an odd last row or column is folded into its neighbour.
+inline Image Downsample(const Image& image)
+{
+   Image half;
+   half.width = (std::max)(1u, image.width / 2);
+   half.height = (std::max)(1u, image.height / 2);
+   half.pixels.resize(size_t(half.width) * half.height * 4);
+   for (uint32_t y = 0; y < half.height; ++y)
+   {
+      const uint32_t y0 = (std::min)(y * 2, image.height - 1);
+      const uint32_t y1 = (std::min)(y * 2 + 1, image.height - 1);
+      for (uint32_t x = 0; x < half.width; ++x)
+      {
+         const uint32_t x0 = (std::min)(x * 2, image.width - 1);
+         const uint32_t x1 = (std::min)(x * 2 + 1, image.width - 1);
+         for (int c = 0; c < 4; ++c)
+         {
+            const unsigned sum = image.At(x0, y0)[c] + image.At(x1, y0)[c] + image.At(x0, y1)[c] + image.At(x1, y1)[c];
+            half.pixels[(size_t(y) * half.width + x) * 4 + c] = uint8_t((sum + 2) / 4);
+         }
+      }
+   }
+   return half;
+}
+
+inline uint16_t To565(const uint8_t* bgr)
+{
+   return uint16_t((bgr[2] >> 3) << 11 | (bgr[1] >> 2) << 5 | bgr[0] >> 3);
+}
+
+inline void From565(uint16_t color, int* bgr)
+{
+   const int r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+   bgr[0] = b << 3 | b >> 2;
+   bgr[1] = g << 2 | g >> 4;
+   bgr[2] = r << 3 | r >> 2;
+}
+
+// Range fit: the endpoints are the block's extremes along its brightest-to-darkest axis, and
+// every texel takes the nearest of the four palette colours. Always the opaque 4-colour mode.
+inline std::vector<uint8_t> CompressBC1(const Image& image)
+{
+   const uint32_t blocksX = (std::max)(1u, (image.width + 3) / 4);
+   const uint32_t blocksY = (std::max)(1u, (image.height + 3) / 4);
+   std::vector<uint8_t> blocks(size_t(blocksX) * blocksY * 8);
+   uint8_t* out = blocks.data();
+   for (uint32_t by = 0; by < blocksY; ++by)
+   {
+      for (uint32_t bx = 0; bx < blocksX; ++bx, out += 8)
+      {
+         const uint8_t* texels[16];
+         for (uint32_t i = 0; i < 16; ++i)
+            texels[i] = image.At((std::min)(bx * 4 + i % 4, image.width - 1), (std::min)(by * 4 + i / 4, image.height - 1));
+
+         const auto luma = [](const uint8_t* bgr) { return bgr[0] * 29 + bgr[1] * 150 + bgr[2] * 77; };
+         const uint8_t* hi = texels[0];
+         const uint8_t* lo = texels[0];
+         for (auto&& texel : texels)
+         {
+            if (luma(texel) > luma(hi))
+               hi = texel;
+            if (luma(texel) < luma(lo))
+               lo = texel;
+         }
+
+         uint16_t c0 = To565(hi);
+         uint16_t c1 = To565(lo);
+         if (c0 < c1)
+            std::swap(c0, c1);
+         int palette[4][3];
+         From565(c0, palette[0]);
+         From565(c1, palette[1]);
+         for (int c = 0; c < 3; ++c)
+         {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+         }
+
+         uint32_t indices = 0;
+         if (c0 != c1)
+         {
+            for (uint32_t i = 0; i < 16; ++i)
+            {
+               int best = 0;
+               int bestDistance = INT32_MAX;
+               for (int p = 0; p < 4; ++p)
+               {
+                  int distance = 0;
+                  for (int c = 0; c < 3; ++c)
+                     distance += (texels[i][c] - palette[p][c]) * (texels[i][c] - palette[p][c]);
+                  if (distance < bestDistance)
+                  {
+                     best = p;
+                     bestDistance = distance;
+                  }
+               }
+               indices |= uint32_t(best) << (i * 2);
+            }
+         }
+
+         out[0] = uint8_t(c0);
+         out[1] = uint8_t(c0 >> 8);
+         out[2] = uint8_t(c1);
+         out[3] = uint8_t(c1 >> 8);
+         std::memcpy(out + 4, &indices, 4);
+      }
+   }
+   return blocks;
+}
+
+inline bool Write(const std::string& path, const Image& image, Format format, bool mips, bool alpha)
+{
+   std::vector<Image> chain{image};
+   while (mips && (chain.back().width > 1 || chain.back().height > 1))
+      chain.push_back(Downsample(chain.back()));
+
+   Header header{};
+   std::memcpy(header.magic, magic, sizeof(magic));
+   header.version = version;
+   header.format = format;
+   header.flags = alpha && format == Format::BGRA8 ? uint32_t(HasAlpha) : 0;
+   header.width = image.width;
+   header.height = image.height;
+   header.levels = uint32_t(chain.size());
+
+   std::vector<Level> levels;
+   std::vector<std::vector<uint8_t>> data;
+   size_t offset = sizeof(Header) + sizeof(Level) * chain.size();
+   for (auto&& level : chain)
+   {
+      offset = (offset + 15) & ~size_t(15);
+      data.push_back(format == Format::BC1 ? CompressBC1(level) : level.pixels);
+      levels.push_back({level.width, level.height, uint32_t(offset), uint32_t(data.back().size())});
+      offset += data.back().size();
+   }
+   if (offset > UINT32_MAX)
+      return false;
+
+   std::ofstream output(path, std::ios::binary);
+   output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+   output.write(reinterpret_cast<const char*>(levels.data()), sizeof(Level) * levels.size());
+   size_t position = sizeof(header) + sizeof(Level) * levels.size();
+   for (size_t i = 0; i < levels.size(); ++i)
+   {
+      const std::vector<char> padding(levels[i].offset - position);
+      output.write(padding.data(), padding.size());
+      output.write(reinterpret_cast<const char*>(data[i].data()), data[i].size());
+      position = size_t(levels[i].offset) + levels[i].size;
+   }
+   return bool(output);
+}
+
+} // namespace TextureContainer
@@ -1,20 +1,101 @@
 #include "stdafx.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <typeinfo>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <windows.h> 
 #include <winuser.h> 
 #include <GL/gl.h> 
 #include <GL/glu.h> 
+#include <psapi.h>
+#include "TextureContainer.h"
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
+#ifndef GL_VERSION_1_5
+using GLsizeiptr = std::ptrdiff_t;
+using GLintptr = std::ptrdiff_t;
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_STREAM_DRAW 0x88E0
+#define GL_STREAM_READ 0x88E1
+#define GL_STATIC_DRAW 0x88E4
+#define GL_READ_ONLY 0x88B8
+#define GL_WRITE_ONLY 0x88B9
+#define GL_QUERY_RESULT 0x8866
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+#ifndef GL_VERSION_1_2
+#define GL_TEXTURE_BASE_LEVEL 0x813C
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+
+#ifndef GL_VERSION_1_4
+#define GL_DEPTH_COMPONENT24 0x81A6
+#endif
+
+#ifndef GL_VERSION_2_1
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+
+#ifndef GL_VERSION_3_0
+#define GL_FRAMEBUFFER 0x8D40
+#define GL_RENDERBUFFER 0x8D41
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#define GL_DEPTH_ATTACHMENT 0x8D00
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#define GL_HALF_FLOAT 0x140B
+#endif
+
+#ifndef GL_EXT_texture_compression_s3tc
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+#ifndef GL_VERSION_3_2
+using GLuint64 = uint64_t;
+#endif
+
+#ifndef GL_VERSION_3_3
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+
+#ifndef GL_VERSION_2_0
+using GLchar = char;
+#define GL_FRAGMENT_SHADER 0x8B30
+#define GL_VERTEX_SHADER 0x8B31
+#define GL_COMPILE_STATUS 0x8B81
+#define GL_LINK_STATUS 0x8B82
+#endif
 
 
 namespace
@@ -52,662 +133,7472 @@ BOOL bSetupPixelFormat(HDC hdc)
    return TRUE;
 }
 
-struct QuadricDeleter { void operator()(GLUquadricObj* obj) { gluDeleteQuadric(obj); } };
-using QuadricPtr = std::unique_ptr<GLUquadricObj, QuadricDeleter>;
 struct GLList
 {
    explicit GLList(GLuint id, GLenum mode) { glNewList(id, mode); }
    ~GLList() { glEndList(); }
 };
 
-GLvoid setProjection(GLsizei width, GLsizei height)
+constexpr double pi = 3.14159265358979323846;
+
+// Column-major, as glLoadMatrixf takes it.
+using Matrix4 = std::array<GLfloat, 16>;
+
+Matrix4 multiply(const Matrix4& a, const Matrix4& b)
+{
+   Matrix4 m{};
+   for (int column = 0; column < 4; ++column)
+      for (int row = 0; row < 4; ++row)
+         for (int k = 0; k < 4; ++k)
+            m[column * 4 + row] += a[k * 4 + row] * b[column * 4 + k];
+   return m;
+}
+
+Matrix4 translation(GLfloat x, GLfloat y, GLfloat z)
+{
+   return {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, x, y, z, 1};
+}
+
+// As glRotate: degrees about an axis, which need not be unit length.
+Matrix4 rotation(double degrees, GLfloat x, GLfloat y, GLfloat z)
 {
+   const GLfloat length = std::sqrt(x * x + y * y + z * z);
+   x /= length;
+   y /= length;
+   z /= length;
+   const GLfloat c = GLfloat(std::cos(degrees * pi / 180));
+   const GLfloat s = GLfloat(std::sin(degrees * pi / 180));
+   return {
+      x * x * (1 - c) + c, y * x * (1 - c) + z * s, x * z * (1 - c) - y * s, 0,
+      x * y * (1 - c) - z * s, y * y * (1 - c) + c, y * z * (1 - c) + x * s, 0,
+      x * z * (1 - c) + y * s, y * z * (1 - c) - x * s, z * z * (1 - c) + c, 0,
+      0, 0, 0, 1};
+}
+
+// As gluPerspective.
+Matrix4 perspective(double fovy, double aspect, double zNear, double zFar)
+{
+   const GLfloat f = GLfloat(1 / std::tan(fovy * pi / 360));
+   return {
+      GLfloat(f / aspect), 0, 0, 0,
+      0, f, 0, 0,
+      0, 0, GLfloat((zFar + zNear) / (zNear - zFar)), -1,
+      0, 0, GLfloat(2 * zFar * zNear / (zNear - zFar)), 0};
+}
+
+constexpr double fieldOfView = 45.0;
+constexpr double nearPlane = 1.0;
+constexpr double farPlane = 25.0;
+
+Matrix4 setProjection(GLsizei width, GLsizei height)
+{
+   const auto projection = perspective(fieldOfView, GLfloat(width) / (std::max)(height, 1), nearPlane, farPlane);
    glViewport(0, 0, width, height);
    glMatrixMode(GL_PROJECTION);
-   glLoadIdentity();
-   gluPerspective(45.0, GLfloat(width) / height, 1.0, 25.0);
+   glLoadMatrixf(projection.data());
    glMatrixMode(GL_MODELVIEW);
+   return projection;
 }
 
-class IGLObject
+class GLExtensions
 {
 public:
-   GLuint GetID() const { return m_id; }
 
-   virtual size_t GetVersion() const = 0;
-   virtual void Draw() = 0;
+   bool Load()
+   {
+      m_loaded = load(GenBuffers, "glGenBuffers")
+         && load(DeleteBuffers, "glDeleteBuffers")
+         && load(BindBuffer, "glBindBuffer")
+         && load(BufferData, "glBufferData")
+         && load(BufferSubData, "glBufferSubData")
+         && load(MapBuffer, "glMapBuffer")
+         && load(UnmapBuffer, "glUnmapBuffer")
+         && load(CreateShader, "glCreateShader")
+         && load(DeleteShader, "glDeleteShader")
+         && load(ShaderSource, "glShaderSource")
+         && load(CompileShader, "glCompileShader")
+         && load(GetShaderiv, "glGetShaderiv")
+         && load(CreateProgram, "glCreateProgram")
+         && load(DeleteProgram, "glDeleteProgram")
+         && load(AttachShader, "glAttachShader")
+         && load(BindAttribLocation, "glBindAttribLocation")
+         && load(LinkProgram, "glLinkProgram")
+         && load(GetProgramiv, "glGetProgramiv")
+         && load(UseProgram, "glUseProgram")
+         && load(EnableVertexAttribArray, "glEnableVertexAttribArray")
+         && load(DisableVertexAttribArray, "glDisableVertexAttribArray")
+         && load(VertexAttribPointer, "glVertexAttribPointer")
+         && load(VertexAttribDivisor, "glVertexAttribDivisor")
+         && load(DrawElementsInstanced, "glDrawElementsInstanced");
 
-   virtual ~IGLObject() {}
+      const auto extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+      m_s3tc = load(CompressedTexImage2D, "glCompressedTexImage2D")
+         && extensions && std::strstr(extensions, "GL_EXT_texture_compression_s3tc");
+      m_halfFloatVertex = extensions && std::strstr(extensions, "GL_ARB_half_float_vertex");
+      m_framebuffer = load(GenFramebuffers, "glGenFramebuffers")
+         && load(DeleteFramebuffers, "glDeleteFramebuffers")
+         && load(BindFramebuffer, "glBindFramebuffer")
+         && load(FramebufferRenderbuffer, "glFramebufferRenderbuffer")
+         && load(CheckFramebufferStatus, "glCheckFramebufferStatus")
+         && load(GenRenderbuffers, "glGenRenderbuffers")
+         && load(DeleteRenderbuffers, "glDeleteRenderbuffers")
+         && load(BindRenderbuffer, "glBindRenderbuffer")
+         && load(RenderbufferStorage, "glRenderbufferStorage");
+      m_timerQuery = load(GenQueries, "glGenQueries")
+         && load(BeginQuery, "glBeginQuery")
+         && load(EndQuery, "glEndQuery")
+         && load(GetQueryObjectiv, "glGetQueryObjectiv")
+         && load(GetQueryObjectui64v, "glGetQueryObjectui64v");
+      return m_loaded;
+   }
+
+   explicit operator bool() const { return m_loaded; }
+
+   bool HasS3tc() const { return m_s3tc; }
+
+   bool HasTimerQuery() const { return m_timerQuery; }
+
+   bool HasFramebuffer() const { return m_framebuffer; }
+
+   bool HasHalfFloatVertex() const { return m_halfFloatVertex; }
+
+   void (APIENTRY* GenBuffers)(GLsizei, GLuint*) = nullptr;
+   void (APIENTRY* DeleteBuffers)(GLsizei, const GLuint*) = nullptr;
+   void (APIENTRY* BindBuffer)(GLenum, GLuint) = nullptr;
+   void (APIENTRY* BufferData)(GLenum, GLsizeiptr, const void*, GLenum) = nullptr;
+   void (APIENTRY* BufferSubData)(GLenum, GLintptr, GLsizeiptr, const void*) = nullptr;
+   void* (APIENTRY* MapBuffer)(GLenum, GLenum) = nullptr;
+   GLboolean (APIENTRY* UnmapBuffer)(GLenum) = nullptr;
+   GLuint (APIENTRY* CreateShader)(GLenum) = nullptr;
+   void (APIENTRY* DeleteShader)(GLuint) = nullptr;
+   void (APIENTRY* ShaderSource)(GLuint, GLsizei, const GLchar* const*, const GLint*) = nullptr;
+   void (APIENTRY* CompileShader)(GLuint) = nullptr;
+   void (APIENTRY* GetShaderiv)(GLuint, GLenum, GLint*) = nullptr;
+   GLuint (APIENTRY* CreateProgram)() = nullptr;
+   void (APIENTRY* DeleteProgram)(GLuint) = nullptr;
+   void (APIENTRY* AttachShader)(GLuint, GLuint) = nullptr;
+   void (APIENTRY* BindAttribLocation)(GLuint, GLuint, const GLchar*) = nullptr;
+   void (APIENTRY* LinkProgram)(GLuint) = nullptr;
+   void (APIENTRY* GetProgramiv)(GLuint, GLenum, GLint*) = nullptr;
+   void (APIENTRY* UseProgram)(GLuint) = nullptr;
+   void (APIENTRY* EnableVertexAttribArray)(GLuint) = nullptr;
+   void (APIENTRY* DisableVertexAttribArray)(GLuint) = nullptr;
+   void (APIENTRY* VertexAttribPointer)(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) = nullptr;
+   void (APIENTRY* VertexAttribDivisor)(GLuint, GLuint) = nullptr;
+   void (APIENTRY* DrawElementsInstanced)(GLenum, GLsizei, GLenum, const void*, GLsizei) = nullptr;
+   void (APIENTRY* CompressedTexImage2D)(GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei, const void*) = nullptr;
+   void (APIENTRY* GenFramebuffers)(GLsizei, GLuint*) = nullptr;
+   void (APIENTRY* DeleteFramebuffers)(GLsizei, const GLuint*) = nullptr;
+   void (APIENTRY* BindFramebuffer)(GLenum, GLuint) = nullptr;
+   void (APIENTRY* FramebufferRenderbuffer)(GLenum, GLenum, GLenum, GLuint) = nullptr;
+   GLenum (APIENTRY* CheckFramebufferStatus)(GLenum) = nullptr;
+   void (APIENTRY* GenRenderbuffers)(GLsizei, GLuint*) = nullptr;
+   void (APIENTRY* DeleteRenderbuffers)(GLsizei, const GLuint*) = nullptr;
+   void (APIENTRY* BindRenderbuffer)(GLenum, GLuint) = nullptr;
+   void (APIENTRY* RenderbufferStorage)(GLenum, GLenum, GLsizei, GLsizei) = nullptr;
+   void (APIENTRY* GenQueries)(GLsizei, GLuint*) = nullptr;
+   void (APIENTRY* BeginQuery)(GLenum, GLuint) = nullptr;
+   void (APIENTRY* EndQuery)(GLenum) = nullptr;
+   void (APIENTRY* GetQueryObjectiv)(GLuint, GLenum, GLint*) = nullptr;
+   void (APIENTRY* GetQueryObjectui64v)(GLuint, GLenum, GLuint64*) = nullptr;
 
 private:
-   static GLuint m_idCounter;
-   GLuint m_id = ++m_idCounter;
-};
-GLuint IGLObject::m_idCounter;
 
-template <typename T, typename U>
-constexpr bool IsCollectionOf = std::is_convertible_v<std::decay_t<decltype(*std::begin(std::declval<T>()))>, U>;
+   template <typename F>
+   static bool load(F& f, const char* name)
+   {
+      const auto proc = wglGetProcAddress(name);
+      const auto value = reinterpret_cast<std::intptr_t>(proc);
+      f = 3 < value || value < -1 ? reinterpret_cast<F>(proc) : nullptr;
+      return f != nullptr;
+   }
 
-constexpr double floorLevel = 0;
-constexpr double topLevel = 2.5;
+private:
+   bool m_loaded = false;
+   bool m_s3tc = false;
+   bool m_framebuffer = false;
+   bool m_halfFloatVertex = false;
+   bool m_timerQuery = false;
+};
 
-using byte = unsigned char;
+GLExtensions glExt;
 
-template <typename T>
-void extract(std::istreambuf_iterator<char>& it, T& t)
-{
-   for (size_t i = 0; i < sizeof(T); ++i)
-      reinterpret_cast<char*>(&t)[i] = *it++;
-}
+using Clock = std::chrono::steady_clock;
 
-class GLTexture
+// Scoped CPU timings recorded into a ring per thread, and GPU frame times from timer queries on
+// tracks of their own. While disabled a scope costs one relaxed load. The main loop folds every
+// frame's events into rolling averages for the overlay, and the rings export as a Chrome trace.
+class Profiler
 {
 public:
 
-      GLTexture(GLuint id, const std::string& fname)
-         : m_id(id)
+   struct Event
+   {
+      const char* name;
+      int64_t begin;
+      int64_t end;
+   };
+
+   // Written by one thread at a time; read by the main loop and the trace export.
+   class Track
+   {
+   public:
+
+      explicit Track(std::string name) : m_name(std::move(name)) { }
+
+      void Add(const char* name, int64_t begin, int64_t end)
       {
-         std::ifstream input(fname, std::ios::binary);
-         std::istreambuf_iterator<char> it(input);
+         const size_t written = m_written.load(std::memory_order_relaxed);
+         if (m_events.empty())
+            m_events.resize(capacity);
+         // Readers that see this slot rewritten must also see the count that reuses it.
+         std::atomic_thread_fence(std::memory_order_release);
+         m_events[written % capacity] = {name, begin, end};
+         m_written.store(written + 1, std::memory_order_release);
+      }
 
-         extract(it, m_fileHeader);
-         if (m_fileHeader.bfType != 0x4D42)
-            return;
+   private:
+      friend class Profiler;
+      static constexpr size_t capacity = size_t(1) << 15;
 
-         extract(it, m_infoHeader);
-         if (m_infoHeader.biSize != sizeof(m_infoHeader))
-            return;
+      std::string m_name;
+      std::vector<Event> m_events;
+      std::atomic<size_t> m_written{0};
+      size_t m_folded = 0;
+   };
 
-         m_data.reserve(m_fileHeader.bfSize - m_fileHeader.bfOffBits);
+   using TrackPtr = std::shared_ptr<Track>;
 
-         std::copy(it, std::istreambuf_iterator<char>(), std::back_inserter(m_data));
-      }
+   bool IsEnabled() const { return m_state.load(std::memory_order_relaxed) != 0; }
 
-      GLuint GetID() const { return m_id; }
-      LONG GetWidth() const { return m_infoHeader.biWidth; }
-      LONG GetHeight() const { return (std::abs)(m_infoHeader.biHeight); }
-      bool IsTopDown() const { return m_infoHeader.biHeight < 0; }
-      WORD GetBitsPerPixel() const { return m_infoHeader.biBitCount; }
-      DWORD GetFormat() const { return m_infoHeader.biCompression; }
+   void Enable(bool enable) { enable ? m_state.fetch_or(1, std::memory_order_relaxed) : m_state.fetch_and(~1, std::memory_order_relaxed); }
 
-      bool empty() const { return m_data.empty(); }
-      size_t size() const { return m_data.size(); }
-      const byte* begin() const { return reinterpret_cast<const byte*>(m_data.data()); }
-      const byte* end() const { return begin() + size(); }
-      explicit operator bool() const { return !empty(); }
+   // Keeps the profiler recording while anyone holds it, e.g. an overlay showing the averages,
+   // whatever Enable says.
+   void Hold(bool hold) { m_state.fetch_add(hold ? 2 : -2, std::memory_order_relaxed); }
 
-private:
-   GLuint m_id = 0;
-   BITMAPFILEHEADER m_fileHeader{};
-   BITMAPINFOHEADER m_infoHeader{};
-   std::vector<char> m_data;
-};
+   // Nanoseconds since the profiler was created.
+   int64_t Now() const { return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_epoch).count(); }
 
-class GLTestWindow
-{
-public:
+   TrackPtr AddTrack(const std::string& name = {})
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tracks.push_back(std::make_shared<Track>(name.empty() ? "thread " + std::to_string(m_tracks.size()) : name));
+      return m_tracks.back();
+   }
 
-   GLTestWindow(const GLTestWindow&) = delete;
+   Track& GetThreadTrack()
+   {
+      thread_local TrackPtr track;
+      if (!track)
+         track = AddTrack();
+      return *track;
+   }
 
-   GLTestWindow(std::initializer_list<std::shared_ptr<IGLObject>> glObjects = {}) : GLTestWindow(glObjects, {}) { }
+   void NameThread(const std::string& name)
+   {
+      auto& track = GetThreadTrack();
+      std::lock_guard<std::mutex> lock(m_mutex);
+      track.m_name = name;
+   }
 
-   template <typename GLObjectRange>
-   GLTestWindow(const GLObjectRange& glObjects,
-      std::enable_if_t<IsCollectionOf<GLObjectRange, std::shared_ptr<IGLObject>>, int> = {})
+   // Once per frame from the main loop: adds up each scope's time over all threads since the
+   // last call, and moves its average that way.
+   void EndFrame()
    {
-      CreateWindow(
-         m_wndClass.lpszClassName,
-         "Generic OpenGL Sample",
-         WS_OVERLAPPEDWINDOW | WS_CLIPSIBLINGS | WS_CLIPCHILDREN,
-         CW_USEDEFAULT,
-         CW_USEDEFAULT,
-         CW_USEDEFAULT, CW_USEDEFAULT,
-         nullptr,
-         nullptr,
-         m_wndClass.hInstance,
-         this);
+      if (!IsEnabled())
+         return;
 
-      if (m_hwnd)
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::map<std::string, double> frame;
+      for (auto&& track : m_tracks)
       {
-         m_hdc = GetDC(m_hwnd);
-         bSetupPixelFormat(m_hdc);
-         m_hrc = wglCreateContext(m_hdc);
-         wglMakeCurrent(m_hdc, m_hrc);
-
-         RECT rect {};
-         GetClientRect(m_hwnd, &rect);
-         setProjection(rect.right, rect.bottom);
+         for (auto&& event : read(*track, track->m_folded))
+            frame[event.name] += (event.end - event.begin) / 1e6;
+      }
+      for (auto&& [name, ms] : frame)
+         m_averages.emplace(name, ms);
+      for (auto&& [name, average] : m_averages)
+         average += (frame[name] - average) * 0.05;
+   }
 
-         for (auto&& glObject : glObjects)
-            AddGLObject(glObject);
+   // Milliseconds per frame, by scope name.
+   std::vector<std::pair<std::string, double>> GetAverages() const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return {m_averages.begin(), m_averages.end()};
+   }
 
-         ShowWindow(m_hwnd, SW_SHOW);
-         UpdateWindow(m_hwnd);
+   // The events still in the rings, in the Trace Event Format chrome://tracing and Perfetto load.
+   bool WriteTrace(const std::string& path) const
+   {
+      std::ofstream output(path);
+      output << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for (size_t tid = 0; tid < m_tracks.size(); ++tid)
+      {
+         const auto& track = *m_tracks[tid];
+         output << (tid ? ",\n" : "\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+            << ",\"args\":{\"name\":\"" << track.m_name << "\"}}";
+         size_t first = 0;
+         for (auto&& event : read(track, first))
+         {
+            output << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+               << ",\"ts\":" << event.begin / 1e3 << ",\"dur\":" << (event.end - event.begin) / 1e3 << "}";
+         }
       }
+      output << "\n]}\n";
+      return bool(output);
    }
 
-   explicit operator bool() const { return m_hwnd; };
+private:
+   // Copies out the events of a track from index next on and moves next past the last one. Its
+   // owner goes on writing meanwhile: once the count has reached i + capacity, slot i may hold a
+   // newer event or half of one, so whatever the writer lapped during the copy is dropped.
+   static std::vector<Event> read(const Track& track, size_t& next)
+   {
+      const size_t written = track.m_written.load(std::memory_order_acquire);
+      const size_t first = (std::max)(next, written > Track::capacity ? written - Track::capacity : 0);
+      std::vector<Event> events;
+      for (size_t i = first; i < written; ++i)
+         events.push_back(track.m_events[i % Track::capacity]);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const size_t now = track.m_written.load(std::memory_order_relaxed);
+      const size_t lapped = now >= Track::capacity ? now - Track::capacity + 1 : 0;
+      if (lapped > first)
+         events.erase(events.begin(), events.begin() + (std::min)(lapped - first, events.size()));
+      next = written;
+      return events;
+   }
+
+   // The lowest bit is Enable's, the rest counts holds, so a scope still only loads once.
+   std::atomic<int> m_state{0};
+   const Clock::time_point m_epoch = Clock::now();
+   mutable std::mutex m_mutex;
+   std::vector<TrackPtr> m_tracks;
+   std::map<std::string, double> m_averages;
+};
+
+Profiler profiler;
+
+class ProfileScope
+{
+public:
 
-   void AddGLObject(const std::shared_ptr<IGLObject>& glObject)
+   explicit ProfileScope(const char* name) : m_name(profiler.IsEnabled() ? name : nullptr), m_begin(m_name ? profiler.Now() : 0) { }
+
+   ProfileScope(const ProfileScope&) = delete;
+
+   ~ProfileScope()
    {
-      wglMakeCurrent(m_hdc, m_hrc);
-      GLList list(glObject->GetID(), GL_COMPILE);
-      glObject->Draw();
-      m_glObjects[glObject->GetID()] = {glObject->GetVersion(), glObject};
+      if (m_name)
+         profiler.GetThreadTrack().Add(m_name, m_begin, profiler.Now());
    }
 
-   GLvoid Draw(double dt)
+private:
+   const char* m_name;
+   int64_t m_begin;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#if defined(GLTEST_NO_PROFILER)
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#endif
+
+// GPU time of a window's frames from GL_TIME_ELAPSED queries. Results are read a few frames late,
+// and a frame is skipped while its query is still in flight, so the CPU never waits on them. The
+// queries belong to the window's context and go with it.
+class GpuTimer
+{
+public:
+
+   void Begin()
    {
-      //m_latitude = fmod(m_latitude + m_latinc * dt, 360);
-      //m_latitude = 30;
-      m_longitude = fmod(m_longitude + m_longinc * dt, 360);
-      m_longinc *= std::exp(-dt / 2);
-      if (-5 < m_longinc && m_longinc < 5)
-         m_longinc = 0;
+      if (!profiler.IsEnabled() || !glExt.HasTimerQuery())
+         return;
 
-      wglMakeCurrent(m_hdc, m_hrc);
+      if (!m_track)
+      {
+         static std::atomic<size_t> windows{0};
+         m_track = profiler.AddTrack("GPU " + std::to_string(windows++));
+         for (auto&& query : m_queries)
+            glExt.GenQueries(1, &query.name);
+      }
 
-      glEnable(GL_DEPTH_TEST);
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-      glPolygonMode(GL_BACK, GL_LINE);
+      auto& query = m_queries[m_next];
+      if (query.pending)
+         return;
+      query.begin = profiler.Now();
+      glExt.BeginQuery(GL_TIME_ELAPSED, query.name);
+      m_active = &query;
+   }
 
-      glClearColor(0.1f, 0.1f, 0.3f, 1);
-      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-      glMatrixMode(GL_MODELVIEW);
-      glLoadIdentity();
-      glTranslated(0.0, 0.0, -m_viewDistance);
-      glRotated(m_latitude, 1.0, 0.0, 0.0);
-      glRotated(m_longitude, 0.0, 1.0, 0.0);
-      glTranslated(0.0, -m_viewLevel, 0.0);
+   void End()
+   {
+      if (m_active)
+      {
+         glExt.EndQuery(GL_TIME_ELAPSED);
+         m_active->pending = true;
+         m_active = nullptr;
+         m_next = (m_next + 1) % m_queries.size();
+      }
 
-      for (auto&& [id, pair] : m_glObjects)
+      for (auto&& query : m_queries)
       {
-         if (const auto& glObject = pair.second.lock())
+         GLint available = 0;
+         if (query.pending)
+            glExt.GetQueryObjectiv(query.name, GL_QUERY_RESULT_AVAILABLE, &available);
+         if (available)
          {
-            if (pair.first != glObject->GetVersion())
-            {
-               GLList list(glObject->GetID(), GL_COMPILE);
-               glObject->Draw();
-               pair = {glObject->GetVersion(), glObject};
-            }
-            glCallList(id);
-         }
-         else
-         {
-            m_glObjects.erase(id);
+            GLuint64 elapsed = 0;
+            glExt.GetQueryObjectui64v(query.name, GL_QUERY_RESULT, &elapsed);
+            // Some drivers time a context's first query from an unset start; no frame can have
+            // taken longer than the wall time since it began.
+            if (int64_t(elapsed) <= profiler.Now() - query.begin)
+               m_track->Add("GPU frame", query.begin, query.begin + int64_t(elapsed));
+            query.pending = false;
          }
       }
-      SwapBuffers(m_hdc);
    }
 
-   void AddTexture(const GLTexture& texture)
+private:
+
+   struct Query
    {
-      wglMakeCurrent(m_hdc, m_hrc);
+      GLuint name = 0;
+      int64_t begin = 0;
+      bool pending = false;
+   };
 
-      glEnable(GL_TEXTURE_2D);
-      glBindTexture(GL_TEXTURE_2D, texture.GetID());
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.GetWidth(),
-         texture.GetHeight(), 0, GL_BGR_EXT, GL_UNSIGNED_BYTE, texture.begin());
+   Profiler::TrackPtr m_track;
+   std::array<Query, 4> m_queries{};
+   Query* m_active = nullptr;
+   size_t m_next = 0;
+};
 
-      glBindTexture(GL_TEXTURE_2D, 0);
+#ifndef GLTEST_LOG_LEVEL
+#define GLTEST_LOG_LEVEL 0
+#endif
+
+enum class LogLevel { Trace, Debug, Info, Warning, Error };
+
+enum class LogCategory { General, Window, Texture, Shader };
+
+// Levels below this are compiled out.
+constexpr LogLevel minimumLogLevel = LogLevel(GLTEST_LOG_LEVEL);
+
+// Records go through a bounded lock-free queue to a sink thread that formats and writes them, so
+// a caller only pays for a clock read and a copy. The text must be a literal; numbers print in hex
+// and one string argument is copied, truncated. Each category can be limited to a number of
+// records per second. Whatever is dropped, by the limit or a full queue, is counted and reported.
+class Logger
+{
+public:
+
+   Logger()
+   {
+      for (size_t i = 0; i < capacity; ++i)
+         m_cells[i].sequence.store(i, std::memory_order_relaxed);
    }
 
-   ~GLTestWindow()
+   Logger(const Logger&) = delete;
+
+   ~Logger()
    {
-      if (m_hwnd)
+      m_stop = true;
+      if (m_thread.joinable())
+         m_thread.join();
+   }
+
+   // Before the first record; by default records go to std::clog.
+   bool SetOutput(const std::string& path)
+   {
+      m_file.open(path);
+      return bool(m_file);
+   }
+
+   // Zero lifts the limit.
+   void SetRateLimit(LogCategory category, uint32_t perSecond) { m_limits[size_t(category)].perSecond = perSecond; }
+
+   // Records dropped so far because the queue was full.
+   uint64_t GetOverflowed() const { return m_overflowed.load(std::memory_order_relaxed); }
+
+   template <LogLevel level, typename... Args>
+   void Write(LogCategory category, const char* text, const Args&... args)
+   {
+      if constexpr (level >= minimumLogLevel)
       {
-         DestroyWindow(m_hwnd);
+         static_assert((0 + ... + !std::is_convertible_v<const Args&, std::string_view>) <= maxValues, "too many numeric log arguments");
+         static_assert((0 + ... + std::is_convertible_v<const Args&, std::string_view>) <= 1, "more than one string log argument");
+         const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_epoch).count();
+         if (!admit(category, now))
+            return;
+
+         Record record;
+         record.level = level;
+         record.category = category;
+         record.time = now;
+         record.text = text;
+         (store(record, args), ...);
+         if (!push(record))
+         {
+            m_overflow.fetch_add(1, std::memory_order_relaxed);
+            m_overflowed.fetch_add(1, std::memory_order_relaxed);
+         }
+         std::call_once(m_started, [this] { m_thread = std::thread([this] { sinkLoop(); }); });
       }
    }
 
 private:
+   static constexpr size_t capacity = 4096;
+   static constexpr size_t maxValues = 3;
 
-   struct WndClass : public WNDCLASS
+   struct Record
    {
-      WndClass() : WNDCLASS()
-      {
-         lpszClassName = typeid(*this).name();
-         hInstance = GetModuleHandle(nullptr);
+      LogLevel level = LogLevel::Info;
+      LogCategory category = LogCategory::General;
+      int64_t time = 0;
+      const char* text = nullptr;
+      uint64_t values[maxValues]{};
+      uint8_t valueCount = 0;
+      char detail[64]{};
+   };
 
-         style = CS_DBLCLKS | CS_HREDRAW;
-         lpfnWndProc = WndProcInit_;
-         cbClsExtra = 0;
-         cbWndExtra = 0;
-         hIcon = LoadIcon (hInstance, lpszClassName);
-         hCursor = LoadCursor(nullptr, IDC_ARROW);
-         hbrBackground = HBRUSH(COLOR_WINDOW + 1);
-         lpszMenuName = lpszClassName;
-         RegisterClass(this);
-      }
-      ~WndClass()
-      {
-         UnregisterClass(lpszClassName, hInstance);
-      }
+   struct Cell
+   {
+      std::atomic<size_t> sequence{0};
+      Record record;
    };
 
-private:
+   struct Limit
+   {
+      std::atomic<uint32_t> perSecond{0};
+      std::atomic<int64_t> second{0};
+      std::atomic<uint32_t> count{0};
+      std::atomic<uint64_t> dropped{0};
+   };
 
-   static LRESULT WINAPI WndProcInit_(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+   template <typename T>
+   static void store(Record& record, const T& value)
    {
-      if (uMsg == WM_CREATE)
+      if constexpr (std::is_convertible_v<const T&, std::string_view>)
       {
-         const CREATESTRUCT* createStruct = LPCREATESTRUCT(lParam);
-         SetWindowLongPtrA(hWnd, GWLP_USERDATA, LONG_PTR(createStruct->lpCreateParams));
-         SetWindowLongPtrA(hWnd, GWLP_WNDPROC, LONG_PTR(WndProc_));
-         GLTestWindow* wnd = reinterpret_cast<GLTestWindow*>(createStruct->lpCreateParams);
-         wnd->m_hwnd = hWnd;
-         return WndProc_(hWnd, uMsg, wParam, lParam);
+         const std::string_view text(value);
+         std::memcpy(record.detail, text.data(), (std::min)(text.size(), sizeof(record.detail) - 1));
       }
-      return DefWindowProc(hWnd, uMsg, wParam, lParam);
+      else if constexpr (std::is_pointer_v<T>)
+         record.values[record.valueCount++] = uint64_t(reinterpret_cast<std::uintptr_t>(value));
+      else
+         record.values[record.valueCount++] = uint64_t(value);
    }
 
-   static LRESULT WINAPI WndProc_(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+   bool admit(LogCategory category, int64_t now)
    {
-      if (uMsg != 0x84)
-      {
-         std::cout << std::hex << ", " << uMsg;
-      }
-      GLTestWindow* const wnd = reinterpret_cast<GLTestWindow*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
-      const auto res = wnd->WindowProc(hWnd, uMsg, wParam, lParam);
+      auto& limit = m_limits[size_t(category)];
+      const uint32_t perSecond = limit.perSecond.load(std::memory_order_relaxed);
+      if (!perSecond)
+         return true;
 
-      if (uMsg == WM_DESTROY)
+      const int64_t second = now / 1000000000;
+      int64_t current = limit.second.load(std::memory_order_relaxed);
+      if (current != second && limit.second.compare_exchange_strong(current, second, std::memory_order_relaxed))
+         limit.count.store(0, std::memory_order_relaxed);
+      if (limit.count.fetch_add(1, std::memory_order_relaxed) < perSecond)
+         return true;
+      limit.dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+   }
+
+   // Bounded multi-producer queue after Vyukov: a cell's sequence tells whose turn it is.
+   bool push(const Record& record)
+   {
+      size_t position = m_enqueue.load(std::memory_order_relaxed);
+      for (;;)
       {
-         wnd->m_hwnd = nullptr;
-         SetWindowLongPtr(hWnd, GWLP_WNDPROC, LONG_PTR(DefWindowProc));
+         auto& cell = m_cells[position % capacity];
+         const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+         const auto difference = std::intptr_t(sequence) - std::intptr_t(position);
+         if (difference == 0)
+         {
+            if (m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+               cell.record = record;
+               cell.sequence.store(position + 1, std::memory_order_release);
+               return true;
+            }
+         }
+         else if (difference < 0)
+            return false;
+         else
+            position = m_enqueue.load(std::memory_order_relaxed);
       }
-      return res;
    }
 
-   LRESULT WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+   bool pop(Record& record)
    {
-      switch (uMsg)
+      auto& cell = m_cells[m_dequeue % capacity];
+      if (cell.sequence.load(std::memory_order_acquire) != m_dequeue + 1)
+         return false;
+      record = cell.record;
+      cell.sequence.store(m_dequeue + capacity, std::memory_order_release);
+      ++m_dequeue;
+      return true;
+   }
+
+   void sinkLoop()
+   {
+      static const char* const levels[]{"trace", "debug", "info", "warning", "error"};
+      static const char* const categories[]{"general", "window", "texture", "shader"};
+      std::ostream& output = m_file.is_open() ? static_cast<std::ostream&>(m_file) : std::clog;
+      for (bool stop = false; !stop; )
       {
-      case WM_CLOSE:
-         DestroyWindow(hwnd);
-         break;
+         stop = m_stop;
+         for (Record record; pop(record); )
+         {
+            output << std::dec << std::fixed << std::setprecision(3) << "[" << std::setw(10) << record.time / 1e6 << "] "
+               << levels[size_t(record.level)] << " " << categories[size_t(record.category)] << ": " << record.text;
+            for (uint8_t i = 0; i < record.valueCount; ++i)
+               output << " 0x" << std::hex << record.values[i] << std::dec;
+            if (record.detail[0])
+               output << " " << record.detail;
+            output << "\n";
+         }
+         for (size_t i = 0; i < std::size(m_limits); ++i)
+         {
+            if (const auto dropped = m_limits[i].dropped.exchange(0, std::memory_order_relaxed))
+               output << "(" << dropped << " " << categories[i] << " records over the rate limit)\n";
+         }
+         if (const auto overflow = m_overflow.exchange(0, std::memory_order_relaxed))
+            output << "(" << overflow << " records dropped, queue full)\n";
+         output.flush();
+         if (!stop)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+   }
 
-      case WM_DESTROY:
-         if (m_hrc)
-            wglDeleteContext(m_hrc);
+private:
+   const Clock::time_point m_epoch = Clock::now();
+   std::unique_ptr<Cell[]> m_cells = std::make_unique<Cell[]>(capacity);
+   std::atomic<size_t> m_enqueue{0};
+   size_t m_dequeue = 0;
+   Limit m_limits[4];
+   std::atomic<uint64_t> m_overflow{0};
+   std::atomic<uint64_t> m_overflowed{0};
+   std::atomic<bool> m_stop{false};
+   std::once_flag m_started;
+   std::thread m_thread;
+   std::ofstream m_file;
+};
 
-         if (m_hdc)
-            ReleaseDC(hwnd, m_hdc);
+Logger logger;
 
-         break;
+enum class GLResourceType { DisplayList, Texture, Buffer, Program };
 
-      case WM_SIZE:
+// Identifies a set of contexts sharing one object namespace.
+using GLShareGroup = size_t;
+
+// Names are generated per share group and recycled through a pool. A released name only becomes
+// reusable at the next Collect, which each window calls after submitting its frame, so nothing
+// already queued for the frame loses its name. Pooled names beyond the limit are deleted there.
+// Contexts attached with sharing join the first group whose lists they can share, so geometry and
+// textures live once no matter how many windows show them. Windows render on threads of their
+// own, so every call takes the lock.
+class GLResources
+{
+public:
+
+   struct Stats
+   {
+      size_t live = 0;
+      size_t pooled = 0;
+      size_t bytes = 0;
+      size_t generated = 0;
+      size_t deleted = 0;
+   };
+
+   // Call before the context creates any object, as wglShareLists requires.
+   GLShareGroup Attach(HGLRC context, bool share = true)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return attach(context, share);
+   }
+
+   // Zero for a context that was never attached.
+   GLShareGroup GetGroup(HGLRC context = wglGetCurrentContext()) const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return findGroup(context);
+   }
+
+   GLuint Allocate(GLResourceType type)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto& pool = m_groups[groupOf(wglGetCurrentContext())].pools[size_t(type)];
+      GLuint name = 0;
+      if (pool.free.empty())
+      {
+         name = generate(type);
+         pool.stats.generated += name != 0;
+      }
+      else
+      {
+         name = pool.free.back();
+         pool.free.pop_back();
+      }
+      pool.stats.live += name != 0;
+      pool.stats.pooled = pool.free.size();
+      return name;
+   }
+
+   // Storage currently held by the name, as the GL cannot be asked for it.
+   void SetBytes(GLResourceType type, GLuint name, size_t bytes, GLShareGroup group = 0)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto& pool = m_groups[group ? group : groupOf(wglGetCurrentContext())].pools[size_t(type)];
+      auto& size = pool.sizes[name];
+      pool.stats.bytes = pool.stats.bytes - size + bytes;
+      size = bytes;
+   }
+
+   // Safe to call with any context current, or none. Names of a forgotten group are ignored.
+   void Release(GLResourceType type, GLuint name, GLShareGroup group)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto found = m_groups.find(group);
+      if (name && found != m_groups.end())
+         found->second.pools[size_t(type)].pending.push_back(name);
+   }
+
+   void Collect()
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto found = m_groups.find(findGroup(wglGetCurrentContext()));
+      if (found == m_groups.end())
+         return;
+
+      for (size_t type = 0; type < types; ++type)
+      {
+         auto& pool = found->second.pools[type];
+         pool.stats.live -= pool.pending.size();
+         pool.free.insert(pool.free.end(), pool.pending.begin(), pool.pending.end());
+         pool.pending.clear();
+
+         // A program keeps its shaders and link state, so it cannot serve anyone else.
+         const size_t limit = GLResourceType(type) == GLResourceType::Program ? 0 : m_poolLimit;
+         if (pool.free.size() > limit)
          {
-            RECT rect{};
-            GetClientRect(hwnd, &rect);
-            setProjection(rect.right, rect.bottom);
+            const size_t count = pool.free.size() - limit;
+            destroy(GLResourceType(type), pool.free.data() + limit, count);
+            for (size_t i = limit; i < pool.free.size(); ++i)
+            {
+               const auto size = pool.sizes.find(pool.free[i]);
+               if (size != pool.sizes.end())
+               {
+                  pool.stats.bytes -= size->second;
+                  pool.sizes.erase(size);
+               }
+            }
+            pool.free.resize(limit);
+            pool.stats.deleted += count;
+         }
+         pool.stats.pooled = pool.free.size();
+      }
+   }
+
+   // Contexts attached to the group and not yet forgotten.
+   size_t GetMembers(GLShareGroup group) const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto found = m_groups.find(group);
+      return found != m_groups.end() ? found->second.members : 0;
+   }
+
+   // The context is gone. The names go with the last context of its group.
+   void Forget(HGLRC context)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto found = m_contexts.find(context);
+      if (found == m_contexts.end())
+         return;
+      const auto group = m_groups.find(found->second);
+      if (group != m_groups.end() && --group->second.members == 0)
+         m_groups.erase(group);
+      m_contexts.erase(found);
+   }
+
+   void Register(const std::string& key, GLuint name)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_groups[groupOf(wglGetCurrentContext())].keys[key] = name;
+   }
+
+   // Returns the name the key stood for, zero if none.
+   GLuint Unregister(const std::string& key)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto group = m_groups.find(findGroup(wglGetCurrentContext()));
+      if (group == m_groups.end())
+         return 0;
+      const auto found = group->second.keys.find(key);
+      if (found == group->second.keys.end())
+         return 0;
+      const GLuint name = found->second;
+      group->second.keys.erase(found);
+      return name;
+   }
+
+   GLuint Lookup(const std::string& key) const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto group = m_groups.find(findGroup(wglGetCurrentContext()));
+      if (group == m_groups.end())
+         return 0;
+      const auto found = group->second.keys.find(key);
+      return found != group->second.keys.end() ? found->second : 0;
+   }
+
+   Stats GetStats(GLResourceType type) const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      Stats total;
+      for (auto&& [group, resources] : m_groups)
+      {
+         const auto& stats = resources.pools[size_t(type)].stats;
+         total.live += stats.live;
+         total.pooled += stats.pooled;
+         total.bytes += stats.bytes;
+         total.generated += stats.generated;
+         total.deleted += stats.deleted;
+      }
+      return total;
+   }
+
+   void SetPoolLimit(size_t limit)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_poolLimit = limit;
+   }
+
+private:
+   static constexpr size_t types = 4;
+
+   GLShareGroup attach(HGLRC context, bool share)
+   {
+      if (share)
+      {
+         for (auto&& [member, group] : m_contexts)
+         {
+            if (wglShareLists(member, context))
+            {
+               m_contexts[context] = group;
+               ++m_groups[group].members;
+               return group;
+            }
          }
+      }
+      const GLShareGroup group = ++m_lastGroup;
+      m_contexts[context] = group;
+      m_groups[group].members = 1;
+      return group;
+   }
+
+   GLShareGroup findGroup(HGLRC context) const
+   {
+      const auto found = m_contexts.find(context);
+      return found != m_contexts.end() ? found->second : 0;
+   }
+
+   // A context nobody attached gets a group of its own.
+   GLShareGroup groupOf(HGLRC context)
+   {
+      const auto group = findGroup(context);
+      return group ? group : attach(context, false);
+   }
+
+   static GLuint generate(GLResourceType type)
+   {
+      GLuint name = 0;
+      switch (type)
+      {
+      case GLResourceType::DisplayList:
+         name = glGenLists(1);
+         break;
+      case GLResourceType::Texture:
+         glGenTextures(1, &name);
+         break;
+      case GLResourceType::Buffer:
+         if (glExt)
+            glExt.GenBuffers(1, &name);
+         break;
+      case GLResourceType::Program:
+         if (glExt)
+            name = glExt.CreateProgram();
+         break;
+      }
+      return name;
+   }
+
+   static void destroy(GLResourceType type, const GLuint* names, size_t count)
+   {
+      switch (type)
+      {
+      case GLResourceType::DisplayList:
+         for (size_t i = 0; i < count; ++i)
+            glDeleteLists(names[i], 1);
+         break;
+      case GLResourceType::Texture:
+         glDeleteTextures(GLsizei(count), names);
+         break;
+      case GLResourceType::Buffer:
+         glExt.DeleteBuffers(GLsizei(count), names);
          break;
+      case GLResourceType::Program:
+         for (size_t i = 0; i < count; ++i)
+            glExt.DeleteProgram(names[i]);
+         break;
+      }
+   }
+
+   struct Pool
+   {
+      std::vector<GLuint> free;
+      std::vector<GLuint> pending;
+      std::map<GLuint, size_t> sizes;
+      Stats stats;
+   };
+
+   struct Group
+   {
+      std::array<Pool, types> pools;
+      std::map<std::string, GLuint> keys;
+      size_t members = 0;
+   };
+
+   std::map<HGLRC, GLShareGroup> m_contexts;
+   std::map<GLShareGroup, Group> m_groups;
+   GLShareGroup m_lastGroup = 0;
+   mutable std::mutex m_mutex;
+   size_t m_poolLimit = 256;
+};
+
+GLResources glResources;
+
+struct BoundingSphere
+{
+   GLfloat center[3];
+   GLfloat radius;
+};
+
+// The frustum and projection of the window drawing a frame, and what the frame drew.
+struct GLView
+{
+   void Set(const Matrix4& projection, const Matrix4& modelView, GLsizei height)
+   {
+      m_modelView = modelView;
+      m_pixelScale = projection[5] * height / 2;
+      const auto clip = multiply(projection, modelView);
+      for (int i = 0; i < 6; ++i)
+      {
+         // Gribb and Hartmann: each plane is the fourth row of the clip matrix plus or minus another.
+         const int row = i / 2;
+         const GLfloat sign = i % 2 ? -1.0f : 1.0f;
+         auto& plane = m_planes[i];
+         for (int k = 0; k < 4; ++k)
+            plane[k] = clip[k * 4 + 3] + sign * clip[k * 4 + row];
+         const GLfloat length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+         for (auto&& value : plane)
+            value /= length;
+      }
+   }
+
+   // Widens the frustum for a camera that may still turn about pivot by up to angle radians and
+   // move by up to distance before the frame is drawn. A point moves no further in eye space than
+   // the angle times its distance from the pivot, plus the distance, so spheres grow by that.
+   void SetSlack(GLfloat angle, GLfloat distance, const std::array<GLfloat, 3>& pivot)
+   {
+      m_slackAngle = angle;
+      m_slackDistance = distance;
+      m_pivot = pivot;
+   }
+
+   bool IsVisible(const BoundingSphere& bounds) const
+   {
+      if (!cull)
+         return true;
+      GLfloat radius = bounds.radius + m_slackDistance;
+      if (m_slackAngle > 0)
+      {
+         const GLfloat dx = bounds.center[0] - m_pivot[0];
+         const GLfloat dy = bounds.center[1] - m_pivot[1];
+         const GLfloat dz = bounds.center[2] - m_pivot[2];
+         radius += m_slackAngle * std::sqrt(dx * dx + dy * dy + dz * dz);
+      }
+      for (auto&& plane : m_planes)
+      {
+         if (plane[0] * bounds.center[0] + plane[1] * bounds.center[1] + plane[2] * bounds.center[2] + plane[3] < -radius)
+            return false;
+      }
+      return true;
+   }
+
+   // Distance in front of the eye.
+   GLfloat GetDepth(const GLfloat* point) const
+   {
+      const auto& m = m_modelView;
+      return -(m[2] * point[0] + m[6] * point[1] + m[10] * point[2] + m[14]);
+   }
+
+   // Radius on screen, in pixels.
+   GLfloat GetPixelRadius(const BoundingSphere& bounds) const
+   {
+      return bounds.radius * m_pixelScale / (std::max)(GetDepth(bounds.center), 1e-3f);
+   }
+
+   bool cull = true;
+   bool levelOfDetail = true;
+   size_t listTriangles = 0;
+   size_t triangles = 0;
+   size_t culled = 0;
+
+private:
+   Matrix4 m_modelView{};
+   std::array<std::array<GLfloat, 4>, 6> m_planes{};
+   GLfloat m_pixelScale = 1;
+   GLfloat m_slackAngle = 0;
+   GLfloat m_slackDistance = 0;
+   std::array<GLfloat, 3> m_pivot{};
+};
+
+// The GL state a draw item is rendered with. The defaults are the scene's: blended, depth
+// written, back faces outlined, no texture and the fixed-function pipeline.
+struct RenderState
+{
+   GLuint program = 0;
+   GLuint texture = 0;
+   bool blend = true;
+   bool depthWrite = true;
+   bool backLines = true;
+};
+
+// What an object submits to a window's render queue for each part it renders. depth is the
+// distance from the eye that orders the part among the others.
+struct DrawItem
+{
+   size_t part = 0;
+   RenderState state;
+   bool translucent = false;
+   GLfloat depth = 0;
+};
+
+class IGLObject
+{
+public:
+   virtual size_t GetVersion() const = 0;
+   virtual void Draw() = 0;
+   virtual void Transform() const {}
+
+   // Whether Render calls the display list. Windows do not compile Draw() into the list of an
+   // object that draws from buffer objects instead.
+   virtual bool UsesList() const { return true; }
+
+   // World-space bounds for culling. Objects without them are always drawn.
+   virtual bool GetBounds(BoundingSphere& bounds) const { return false; }
+
+   // One item by default, blended, as a display list may hold anything.
+   virtual void Submit(const GLView& view, std::vector<DrawItem>& items) const
+   {
+      DrawItem item;
+      BoundingSphere bounds;
+      if (GetBounds(bounds))
+         item.depth = view.GetDepth(bounds.center);
+      items.push_back(item);
+   }
+
+   // Draws a part submitted, with its state already set. list is the display list the current
+   // window compiled Draw() into; view.listTriangles is what compiling it counted. Whatever is
+   // drawn gets added to view.triangles.
+   virtual void Render(GLuint list, GLView& view, size_t part) const
+   {
+      glPushMatrix();
+      Transform();
+      glCallList(list);
+      glPopMatrix();
+      view.triangles += view.listTriangles;
+   }
+
+   virtual ~IGLObject() {}
+};
+
+// Draw items of a frame under 64-bit keys. Opaque items come first, grouped by state and then
+// front to back; translucent items follow back to front. The keys are radix sorted, and state
+// the previous item already set is not set again.
+class RenderQueue
+{
+public:
+
+   struct Stats
+   {
+      size_t stateChanges = 0;
+      // Items rendered, each of which may issue more than one glDraw call.
+      size_t drawCalls = 0;
+   };
+
+   // Sets the default state whatever the context has, as after creating it.
+   void Reset()
+   {
+      if (glExt)
+         glExt.UseProgram(0);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glEnable(GL_BLEND);
+      glDepthMask(GL_TRUE);
+      glPolygonMode(GL_BACK, GL_LINE);
+      glEnable(GL_DEPTH_TEST);
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      m_current = RenderState();
+   }
+
+   void Submit(const std::shared_ptr<const IGLObject>& object, GLuint list, size_t listTriangles, const GLView& view)
+   {
+      m_submitted.clear();
+      object->Submit(view, m_submitted);
+      for (auto&& item : m_submitted)
+      {
+         m_keys.push_back({getKey(item), uint32_t(m_entries.size())});
+         m_entries.push_back({object, list, listTriangles, item});
+      }
+   }
+
+   // Forgets everything submitted without rendering it.
+   void Discard()
+   {
+      m_keys.clear();
+      m_entries.clear();
+   }
+
+   // Renders and forgets everything submitted, leaving the default state set.
+   void Flush(GLView& view)
+   {
+      m_stats = {};
+      sort();
+      for (auto&& [key, index] : m_keys)
+      {
+         const auto& entry = m_entries[index];
+         apply(entry.item.state);
+         view.listTriangles = entry.listTriangles;
+         entry.object->Render(entry.list, view, entry.item.part);
+         ++m_stats.drawCalls;
+      }
+      apply(RenderState());
+      m_keys.clear();
+      m_entries.clear();
+   }
+
+   const Stats& GetStats() const { return m_stats; }
+
+private:
+
+   struct Entry
+   {
+      std::shared_ptr<const IGLObject> object;
+      GLuint list;
+      size_t listTriangles;
+      DrawItem item;
+   };
+
+   // Translucent flag, 24 bits of depth and 27 bits of state: 8 of program, 16 of texture and
+   // the three switches. Opaque items put the state above the depth, translucent ones below it.
+   static uint64_t getKey(const DrawItem& item)
+   {
+      const auto& state = item.state;
+      const uint64_t bits = uint64_t(state.program & 0xFF) << 19 | uint64_t(state.texture & 0xFFFF) << 3
+         | uint64_t(state.blend) << 2 | uint64_t(state.depthWrite) << 1 | uint64_t(state.backLines);
+      const uint64_t depth = uint64_t((std::min)(1.0, (std::max)(0.0, item.depth / farPlane)) * 0xFFFFFF);
+      if (item.translucent)
+         return uint64_t(1) << 63 | (0xFFFFFF - depth) << 27 | bits;
+      return bits << 24 | depth;
+   }
+
+   // Least significant byte first; a byte all keys share is skipped.
+   void sort()
+   {
+      m_sorted.resize(m_keys.size());
+      for (int shift = 0; shift < 64 && !m_keys.empty(); shift += 8)
+      {
+         size_t offsets[256]{};
+         for (auto&& entry : m_keys)
+            ++offsets[entry.first >> shift & 0xFF];
+         if (offsets[m_keys.front().first >> shift & 0xFF] == m_keys.size())
+            continue;
+         size_t offset = 0;
+         for (auto&& count : offsets)
+            offset += std::exchange(count, offset);
+         for (auto&& entry : m_keys)
+            m_sorted[offsets[entry.first >> shift & 0xFF]++] = entry;
+         m_keys.swap(m_sorted);
+      }
+   }
+
+   void apply(const RenderState& state)
+   {
+      if (state.program != m_current.program)
+      {
+         glExt.UseProgram(state.program);
+         ++m_stats.stateChanges;
+      }
+      if (state.texture != m_current.texture)
+      {
+         glBindTexture(GL_TEXTURE_2D, state.texture);
+         ++m_stats.stateChanges;
+      }
+      if (state.blend != m_current.blend)
+      {
+         if (state.blend)
+            glEnable(GL_BLEND);
+         else
+            glDisable(GL_BLEND);
+         ++m_stats.stateChanges;
+      }
+      if (state.depthWrite != m_current.depthWrite)
+      {
+         glDepthMask(state.depthWrite ? GL_TRUE : GL_FALSE);
+         ++m_stats.stateChanges;
+      }
+      if (state.backLines != m_current.backLines)
+      {
+         glPolygonMode(GL_BACK, state.backLines ? GL_LINE : GL_FILL);
+         ++m_stats.stateChanges;
+      }
+      m_current = state;
+   }
+
+private:
+   RenderState m_current;
+   Stats m_stats;
+   std::vector<DrawItem> m_submitted;
+   std::vector<Entry> m_entries;
+   std::vector<std::pair<uint64_t, uint32_t>> m_keys;
+   std::vector<std::pair<uint64_t, uint32_t>> m_sorted;
+};
+
+template <typename T, typename U>
+constexpr bool IsCollectionOf = std::is_convertible_v<std::decay_t<decltype(*std::begin(std::declval<T>()))>, U>;
+
+constexpr double floorLevel = 0;
+constexpr double topLevel = 2.5;
+
+using byte = unsigned char;
+
+// Read-only view of a whole file; empty if the file cannot be opened or is empty.
+class MappedFile
+{
+public:
+
+   explicit MappedFile(const std::string& path)
+   {
+      const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      if (file == INVALID_HANDLE_VALUE)
+         return;
+      LARGE_INTEGER size{};
+      if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+      {
+         if (const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr))
+         {
+            if ((m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0))))
+               m_size = size_t(size.QuadPart);
+            CloseHandle(mapping);
+         }
+      }
+      CloseHandle(file);
+   }
+
+   MappedFile(const MappedFile&) = delete;
+
+   ~MappedFile()
+   {
+      if (!m_data)
+         return;
+      UnmapViewOfFile(m_data);
+   }
+
+   const char* data() const { return m_data; }
+   size_t size() const { return m_size; }
+   explicit operator bool() const { return m_data; }
+
+private:
+   const char* m_data = nullptr;
+   size_t m_size = 0;
+};
+
+// Pixels are always exposed bottom-up as BGR or BGRA rows padded to four bytes, which is what
+// glTexImage2D expects with the default unpack alignment. Bottom-up 24-bit and 32-bit files are
+// used in place from the mapping; top-down and palette images are converted into a copy.
+// Baked containers (TextureContainer.h) are used in place with all their levels.
+class GLTexture
+{
+public:
+
+      explicit GLTexture(const std::string& fname)
+         : m_path(fname), m_file(std::make_shared<MappedFile>(fname))
+      {
+         if (!load())
+         {
+            logger.Write<LogLevel::Warning>(LogCategory::Texture, "unsupported texture", m_path);
+            m_height = 0;
+            m_file.reset();
+            m_data.clear();
+            m_levels.clear();
+         }
+         else if (m_levels.empty())
+         {
+            m_levels.push_back({m_width, m_height, m_offset, size()});
+         }
+      }
+
+      // 24-bit bottom-up pixels built in memory, registered under key instead of a path.
+      GLTexture(const std::string& key, LONG width, LONG height, std::vector<char> pixels)
+         : m_path(key), m_width(width), m_height(height), m_bitsPerPixel(24),
+         m_stride((size_t(width) * 3 + 3) & ~size_t(3)), m_data(std::move(pixels))
+      {
+         m_levels.push_back({m_width, m_height, 0, size()});
+      }
+
+      struct Level
+      {
+         LONG width;
+         LONG height;
+         size_t offset;
+         size_t size;
+      };
+
+      const std::string& GetPath() const { return m_path; }
+      LONG GetWidth() const { return m_width; }
+      LONG GetHeight() const { return m_height; }
+      WORD GetBitsPerPixel() const { return m_bitsPerPixel; }
+      GLenum GetPixelFormat() const { return m_bitsPerPixel == 32 ? GL_BGRA_EXT : GL_BGR_EXT; }
+      bool HasAlpha() const { return m_alpha; }
+      size_t GetStride() const { return m_stride; }
+      const byte* GetRow(LONG row) const { return begin() + row * m_stride; }
+
+      // Whether the pixels are read straight from the mapped file.
+      bool IsMapped() const { return bool(m_file); }
+
+      // BC1 blocks instead of rows; GetRow and GetStride do not apply.
+      bool IsCompressed() const { return m_compressed; }
+      size_t GetLevelCount() const { return m_levels.size(); }
+      const Level& GetLevel(size_t i) const { return m_levels[i]; }
+      const byte* GetLevelData(size_t i) const { return base() + m_levels[i].offset; }
+
+      // What the GL will hold once every level is uploaded; uncompressed texels take four bytes.
+      size_t GetStorageBytes() const
+      {
+         size_t bytes = 0;
+         for (auto&& level : m_levels)
+            bytes += m_compressed ? level.size : size_t(level.width) * level.height * 4;
+         return bytes;
+      }
+
+      bool empty() const { return !m_height; }
+      size_t size() const { return m_stride * m_height; }
+      const byte* begin() const { return base() + m_offset; }
+      const byte* end() const { return begin() + size(); }
+      explicit operator bool() const { return !empty(); }
+
+private:
+
+   const byte* base() const { return reinterpret_cast<const byte*>(m_file ? m_file->data() : m_data.data()); }
+
+   bool loadContainer(const char* data, size_t size)
+   {
+      using TextureContainer::Format;
+      TextureContainer::Header header{};
+      std::memcpy(&header, data, sizeof(header));
+      if (header.version != TextureContainer::version || (header.format != Format::BGRA8 && header.format != Format::BC1)
+         || header.levels == 0 || header.levels > 32 || header.width == 0 || header.height == 0
+         || header.width > 65536 || header.height > 65536 || (size - sizeof(header)) / sizeof(TextureContainer::Level) < header.levels)
+         return false;
+
+      for (uint32_t i = 0; i < header.levels; ++i)
+      {
+         TextureContainer::Level level{};
+         std::memcpy(&level, data + sizeof(header) + i * sizeof(level), sizeof(level));
+         if (level.offset % 4 || level.offset > size || size - level.offset < level.size
+            || level.width == 0 || level.height == 0 || level.width > header.width || level.height > header.height
+            || level.size != TextureContainer::LevelSize(header.format, level.width, level.height))
+            return false;
+         m_levels.push_back({LONG(level.width), LONG(level.height), level.offset, level.size});
+      }
+
+      m_width = LONG(header.width);
+      m_height = LONG(header.height);
+      m_compressed = header.format == Format::BC1;
+      m_bitsPerPixel = m_compressed ? 4 : 32;
+      m_alpha = header.flags & TextureContainer::HasAlpha;
+      m_stride = m_compressed ? 0 : size_t(m_width) * 4;
+      m_offset = m_levels.front().offset;
+      return true;
+   }
+
+   bool load()
+   {
+      const char* const data = m_file->data();
+      const size_t size = m_file->size();
+      if (TextureContainer::IsContainer(data, size))
+         return loadContainer(data, size);
+      BITMAPFILEHEADER fileHeader{};
+      BITMAPINFOHEADER infoHeader{};
+      if (size < sizeof(fileHeader) + sizeof(infoHeader))
+         return false;
+
+      std::memcpy(&fileHeader, data, sizeof(fileHeader));
+      std::memcpy(&infoHeader, data + sizeof(fileHeader), sizeof(infoHeader));
+      if (fileHeader.bfType != 0x4D42 || infoHeader.biSize < sizeof(infoHeader) || infoHeader.biPlanes != 1
+         || infoHeader.biWidth <= 0 || infoHeader.biHeight == 0 || infoHeader.biWidth > 65536 || (std::abs)(infoHeader.biHeight) > 65536)
+         return false;
+
+      const WORD bits = infoHeader.biBitCount;
+      if (bits != 8 && bits != 24 && bits != 32)
+         return false;
+
+      const size_t width = size_t(infoHeader.biWidth);
+      const size_t height = size_t((std::abs)(infoHeader.biHeight));
+      const size_t stride = (width * bits / 8 + 3) & ~size_t(3);
+      const size_t offset = fileHeader.bfOffBits;
+      if (offset > size || (size - offset) / stride < height)
+         return false;
+
+      const char* const extra = data + sizeof(fileHeader) + sizeof(infoHeader);
+      const size_t extraSize = size - sizeof(fileHeader) - sizeof(infoHeader);
+      if (infoHeader.biCompression == BI_BITFIELDS)
+      {
+         // The masks follow a BITMAPINFOHEADER; larger headers carry them inside.
+         DWORD masks[4]{};
+         std::memcpy(masks, extra, (std::min)(sizeof(masks), extraSize));
+         if (bits != 32 || masks[0] != 0x00FF0000 || masks[1] != 0x0000FF00 || masks[2] != 0x000000FF)
+            return false;
+         m_alpha = infoHeader.biSize > sizeof(infoHeader) && masks[3] == 0xFF000000;
+      }
+      else if (infoHeader.biCompression != BI_RGB)
+      {
+         return false;
+      }
+
+      m_width = infoHeader.biWidth;
+      m_height = LONG(height);
+      m_bitsPerPixel = bits == 8 ? 24 : bits;
+      m_stride = (width * m_bitsPerPixel / 8 + 3) & ~size_t(3);
+
+      const bool topDown = infoHeader.biHeight < 0;
+      if (bits != 8 && !topDown)
+      {
+         m_offset = offset;
+         return true;
+      }
+
+      const char* const pixels = data + offset;
+      m_data.resize(m_stride * height);
+      if (bits != 8)
+      {
+         for (size_t row = 0; row < height; ++row)
+            std::memcpy(&m_data[row * m_stride], pixels + (height - 1 - row) * stride, m_stride);
+      }
+      else
+      {
+         const size_t colors = infoHeader.biClrUsed ? (std::min)(size_t(infoHeader.biClrUsed), size_t(256)) : 256;
+         const char* const palette = data + sizeof(fileHeader) + infoHeader.biSize;
+         if (palette + colors * 4 > data + offset)
+            return false;
+         for (size_t row = 0; row < height; ++row)
+         {
+            const byte* const source = reinterpret_cast<const byte*>(pixels + (topDown ? height - 1 - row : row) * stride);
+            char* const target = &m_data[row * m_stride];
+            for (size_t x = 0; x < width; ++x)
+            {
+               const size_t index = (std::min)(size_t(source[x]), colors - 1);
+               std::memcpy(target + x * 3, palette + index * 4, 3);
+            }
+         }
+      }
+      m_file.reset();
+      return true;
+   }
+
+   std::string m_path;
+   LONG m_width = 0;
+   LONG m_height = 0;
+   WORD m_bitsPerPixel = 0;
+   bool m_alpha = false;
+   bool m_compressed = false;
+   size_t m_stride = 0;
+   std::shared_ptr<const MappedFile> m_file;
+   size_t m_offset = 0;
+   std::vector<char> m_data;
+   std::vector<Level> m_levels;
+};
+
+// Packs textures side by side into one power-of-two texture, followed by a white block
+// that lets untextured geometry share the same draw call. The layout is known on construction;
+// the pixels are only packed by Build, which may run on a decode thread.
+class TextureAtlas
+{
+public:
+
+   struct Region
+   {
+      GLfloat u0, v0, u1, v1;
+   };
+
+   TextureAtlas(const std::string& key, const std::vector<GLTexture>& textures)
+      : m_key(key), m_textures(textures)
+   {
+      LONG width = whiteSize;
+      LONG height = whiteSize;
+      for (auto&& texture : textures)
+      {
+         if (usable(texture))
+         {
+            width += texture.GetWidth();
+            height = (std::max)(height, texture.GetHeight());
+         }
+      }
+      m_width = powerOfTwo(width);
+      m_height = powerOfTwo(height);
+
+      LONG x = 0;
+      for (auto&& texture : textures)
+      {
+         if (!usable(texture))
+         {
+            m_regions.push_back({});
+            continue;
+         }
+         m_regions.push_back(region(x, texture.GetWidth(), texture.GetHeight(), m_width, m_height));
+         x += texture.GetWidth();
+      }
+
+      m_white = region(x, whiteSize, whiteSize, m_width, m_height);
+      for (auto& region : m_regions)
+      {
+         if (region.u0 == region.u1)
+            region = m_white;
+      }
+   }
+
+   GLTexture Build() const
+   {
+      const size_t stride = size_t(m_width) * 3;
+      std::vector<char> pixels(stride * m_height);
+      LONG x = 0;
+      for (auto&& texture : m_textures)
+      {
+         if (!usable(texture))
+            continue;
+
+         const size_t pixelBytes = texture.GetBitsPerPixel() / 8;
+         for (LONG row = 0; row < texture.GetHeight(); ++row)
+         {
+            const byte* const source = texture.GetRow(row);
+            char* const target = &pixels[row * stride + x * 3];
+            if (pixelBytes == 3)
+               std::memcpy(target, source, size_t(texture.GetWidth()) * 3);
+            else
+               for (LONG i = 0; i < texture.GetWidth(); ++i)
+                  std::memcpy(target + i * 3, source + i * pixelBytes, 3);
+         }
+         x += texture.GetWidth();
+      }
+
+      for (LONG row = 0; row < whiteSize; ++row)
+         std::fill_n(pixels.begin() + row * stride + x * 3, whiteSize * 3, char(0xFF));
+      return GLTexture(m_key, m_width, m_height, std::move(pixels));
+   }
+
+   const std::string& GetKey() const { return m_key; }
+
+   // Textures that could not be packed map to the white block.
+   const Region& GetRegion(size_t i) const { return m_regions[i]; }
+   const Region& GetWhite() const { return m_white; }
+
+private:
+   static constexpr LONG whiteSize = 4;
+
+   static bool usable(const GLTexture& texture)
+   {
+      return !texture.empty() && !texture.IsCompressed();
+   }
+
+   static LONG powerOfTwo(LONG value)
+   {
+      LONG result = 1;
+      while (result < value)
+         result *= 2;
+      return result;
+   }
+
+   // Inset by half a texel so linear filtering never reaches a neighbour.
+   static Region region(LONG x, LONG w, LONG h, LONG width, LONG height)
+   {
+      return {(x + 0.5f) / width, 0.5f / height, (x + w - 0.5f) / width, (h - 0.5f) / height};
+   }
+
+   std::string m_key;
+   std::vector<GLTexture> m_textures;
+   LONG m_width = 0;
+   LONG m_height = 0;
+   std::vector<Region> m_regions;
+   Region m_white{};
+};
+
+// Decoded textures keyed by path, shared by every window. Decoding runs on background threads;
+// each window uploads an entry once it is ready.
+class TextureCache
+{
+public:
+
+   using Loader = std::function<GLTexture()>;
+
+   class Entry
+   {
+   public:
+      explicit Entry(const std::string& key) : m_key(key) {}
+
+      const std::string& GetKey() const { return m_key; }
+      bool IsReady() const { return m_ready.load(std::memory_order_acquire); }
+
+      // Only once IsReady.
+      const GLTexture& GetTexture() const { return *m_texture; }
+
+   private:
+      friend class TextureCache;
+
+      std::string m_key;
+      Loader m_loader;
+      std::unique_ptr<GLTexture> m_texture;
+      std::atomic<bool> m_ready{false};
+   };
+
+   using EntryPtr = std::shared_ptr<const Entry>;
+
+   struct Stats
+   {
+      size_t hits = 0;
+      size_t misses = 0;
+      size_t pending = 0;
+      double decodeSeconds = 0;
+   };
+
+   explicit TextureCache(size_t threads = 2) : m_threadCount(threads) {}
+
+   TextureCache(const TextureCache&) = delete;
+
+   ~TextureCache()
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_stop = true;
+      }
+      m_wake.notify_all();
+      for (auto&& thread : m_threads)
+         thread.join();
+   }
+
+   // The loader defaults to reading the key as a bitmap path.
+   EntryPtr Load(const std::string& key, Loader loader = {})
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto& entry = m_entries[key];
+      if (entry)
+      {
+         ++m_stats.hits;
+         return entry;
+      }
+
+      ++m_stats.misses;
+      ++m_stats.pending;
+      entry = std::make_shared<Entry>(key);
+      entry->m_loader = loader ? std::move(loader) : [key] { return GLTexture(key); };
+      m_queue.push_back(entry);
+      while (m_threads.size() < m_threadCount)
+         m_threads.emplace_back([this] { decodeLoop(); });
+      m_wake.notify_one();
+      return entry;
+   }
+
+   // Entries already handed out stay valid; the next Load of the key decodes it again.
+   void Evict(const std::string& key)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_entries.erase(key);
+   }
+
+   Stats GetStats() const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_stats;
+   }
+
+private:
+
+   void decodeLoop()
+   {
+      profiler.NameThread("decode");
+      for (;;)
+      {
+         std::shared_ptr<Entry> entry;
+         {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_stop)
+               return;
+            entry = std::move(m_queue.front());
+            m_queue.pop_front();
+         }
+
+         PROFILE_SCOPE("Decode");
+         const auto start = std::chrono::steady_clock::now();
+         entry->m_texture = std::make_unique<GLTexture>(entry->m_loader());
+         entry->m_loader = nullptr;
+         entry->m_ready.store(true, std::memory_order_release);
+         const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+         std::lock_guard<std::mutex> lock(m_mutex);
+         --m_stats.pending;
+         m_stats.decodeSeconds += elapsed.count();
+      }
+   }
+
+private:
+   size_t m_threadCount = 2;
+   mutable std::mutex m_mutex;
+   std::condition_variable m_wake;
+   std::map<std::string, std::shared_ptr<Entry>> m_entries;
+   std::deque<std::shared_ptr<Entry>> m_queue;
+   std::vector<std::thread> m_threads;
+   Stats m_stats;
+   bool m_stop = false;
+};
+
+TextureCache textureCache;
+
+enum class QuadricType { Sphere, Cylinder, Disk };
+
+// Triangles drawn on this thread so far; a wireframe counts the surface it outlines.
+thread_local size_t drawnTriangles = 0;
+
+class QuadricMesh
+{
+public:
+
+   struct Vertex
+   {
+      GLfloat position[3];
+      GLfloat normal[3];
+   };
+
+   QuadricMesh(QuadricType type, GLenum drawStyle, double a, double b, double c, int slices, int rows)
+      : m_triangles(size_t(2) * slices * rows)
+   {
+      for (int i = 0; i <= rows; ++i)
+      {
+         const double t = double(i) / rows;
+         for (int j = 0; j < slices; ++j)
+         {
+            const double theta = 2 * pi * j / slices;
+            double position[3]{};
+            double normal[3]{};
+            switch (type)
+            {
+            case QuadricType::Sphere:
+               normal[0] = std::sin(pi * t) * std::cos(theta);
+               normal[1] = std::sin(pi * t) * std::sin(theta);
+               normal[2] = std::cos(pi * t);
+               for (int k = 0; k < 3; ++k)
+                  position[k] = a * normal[k];
+               break;
+
+            case QuadricType::Cylinder:
+               {
+                  const double radius = a + (b - a) * t;
+                  const double nz = (a - b) / c;
+                  const double length = std::sqrt(1 + nz * nz);
+                  position[0] = radius * std::cos(theta);
+                  position[1] = radius * std::sin(theta);
+                  position[2] = c * t;
+                  normal[0] = std::cos(theta) / length;
+                  normal[1] = std::sin(theta) / length;
+                  normal[2] = nz / length;
+               }
+               break;
+
+            case QuadricType::Disk:
+               {
+                  const double radius = a + (b - a) * t;
+                  position[0] = radius * std::cos(theta);
+                  position[1] = radius * std::sin(theta);
+                  normal[2] = 1;
+               }
+               break;
+            }
+            m_vertices.push_back({
+               {GLfloat(position[0]), GLfloat(position[1]), GLfloat(position[2])},
+               {GLfloat(normal[0]), GLfloat(normal[1]), GLfloat(normal[2])}});
+         }
+      }
+
+      const auto vertex = [slices](int i, int j) { return GLushort(i * slices + j % slices); };
+      switch (drawStyle)
+      {
+      case GLU_FILL:
+         m_mode = GL_TRIANGLES;
+         for (int i = 0; i < rows; ++i)
+         {
+            for (int j = 0; j < slices; ++j)
+            {
+               // Cylinder rows run along +z, the opposite way round to the sphere and disk rows
+               const int i0 = type == QuadricType::Cylinder ? i + 1 : i;
+               const int i1 = type == QuadricType::Cylinder ? i : i + 1;
+               m_indices.insert(m_indices.end(), {
+                  vertex(i0, j), vertex(i1, j), vertex(i1, j + 1),
+                  vertex(i0, j), vertex(i1, j + 1), vertex(i0, j + 1)});
+            }
+         }
+         break;
+
+      case GLU_POINT:
+         m_mode = GL_POINTS;
+         for (size_t i = 0; i < m_vertices.size(); ++i)
+            m_indices.push_back(GLushort(i));
+         break;
+
+      default:
+         m_mode = GL_LINES;
+         for (int i = 0; i <= rows; ++i)
+         {
+            for (int j = 0; j < slices; ++j)
+            {
+               if (i < rows)
+                  m_indices.insert(m_indices.end(), {vertex(i, j), vertex(i + 1, j)});
+               if (type != QuadricType::Sphere || 0 < i && i < rows)
+                  m_indices.insert(m_indices.end(), {vertex(i, j), vertex(i, j + 1)});
+            }
+         }
+         break;
+      }
+   }
+
+   GLenum GetMode() const { return m_mode; }
+   const std::vector<Vertex>& GetVertices() const { return m_vertices; }
+   const std::vector<GLushort>& GetIndices() const { return m_indices; }
+   size_t GetSize() const { return m_vertices.size() * sizeof(Vertex) + m_indices.size() * sizeof(GLushort); }
+   size_t GetTriangles() const { return m_triangles; }
+
+   void Draw() const
+   {
+      drawnTriangles += m_triangles;
+      glEnableClientState(GL_VERTEX_ARRAY);
+      glEnableClientState(GL_NORMAL_ARRAY);
+      glVertexPointer(3, GL_FLOAT, sizeof(Vertex), m_vertices.front().position);
+      glNormalPointer(GL_FLOAT, sizeof(Vertex), m_vertices.front().normal);
+      glDrawElements(m_mode, GLsizei(m_indices.size()), GL_UNSIGNED_SHORT, m_indices.data());
+      glDisableClientState(GL_NORMAL_ARRAY);
+      glDisableClientState(GL_VERTEX_ARRAY);
+   }
+
+private:
+   size_t m_triangles;
+   GLenum m_mode = GL_LINES;
+   std::vector<Vertex> m_vertices;
+   std::vector<GLushort> m_indices;
+};
+
+class QuadricMeshCache
+{
+public:
+
+   struct Stats
+   {
+      size_t hits = 0;
+      size_t misses = 0;
+      size_t evictions = 0;
+      size_t bytes = 0;
+   };
+
+   using MeshPtr = std::shared_ptr<const QuadricMesh>;
+
+   MeshPtr Sphere(GLenum drawStyle, double radius, int slices, int stacks)
+   {
+      return Get(QuadricType::Sphere, drawStyle, radius, 0, 0, slices, stacks);
+   }
+
+   MeshPtr Cylinder(GLenum drawStyle, double base, double top, double height, int slices, int stacks)
+   {
+      return Get(QuadricType::Cylinder, drawStyle, base, top, height, slices, stacks);
+   }
+
+   MeshPtr Disk(GLenum drawStyle, double inner, double outer, int slices, int loops)
+   {
+      return Get(QuadricType::Disk, drawStyle, inner, outer, 0, slices, loops);
+   }
+
+   // Indices are 16-bit, so rows are cut down until the (rows + 1) * slices vertices fit.
+   MeshPtr Get(QuadricType type, GLenum drawStyle, double a, double b, double c, int slices, int rows)
+   {
+      slices = (std::min)((std::max)(slices, 1), maxVertices / 2);
+      rows = (std::min)((std::max)(rows, 1), maxVertices / slices - 1);
+      const Key key{type, drawStyle, a, b, c, slices, rows};
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto found = m_meshes.find(key);
+      if (found != m_meshes.end())
+      {
+         ++m_stats.hits;
+         m_lru.splice(m_lru.begin(), m_lru, found->second.second);
+         return found->second.first;
+      }
+
+      ++m_stats.misses;
+      auto mesh = std::make_shared<const QuadricMesh>(type, drawStyle, a, b, c, slices, rows);
+      m_lru.push_front(key);
+      m_meshes[key] = {mesh, m_lru.begin()};
+      m_stats.bytes += mesh->GetSize();
+      evict();
+      return mesh;
+   }
+
+   // Zero means unlimited. Evicted meshes stay alive while objects still hold them.
+   void SetCapacity(size_t bytes)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_capacity = bytes;
+      evict();
+   }
+
+   Stats GetStats() const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_stats;
+   }
+
+private:
+
+   using Key = std::tuple<QuadricType, GLenum, double, double, double, int, int>;
+
+   static constexpr int maxVertices = 65536;
+
+   void evict()
+   {
+      while (m_capacity && m_stats.bytes > m_capacity && !m_lru.empty())
+      {
+         const auto found = m_meshes.find(m_lru.back());
+         m_stats.bytes -= found->second.first->GetSize();
+         ++m_stats.evictions;
+         m_meshes.erase(found);
+         m_lru.pop_back();
+      }
+   }
+
+private:
+   size_t m_capacity = 0;
+   Stats m_stats;
+   std::list<Key> m_lru;
+   std::map<Key, std::pair<MeshPtr, std::list<Key>::iterator>> m_meshes;
+   mutable std::mutex m_mutex;
+};
+
+QuadricMeshCache quadricMeshes;
+
+// Round to nearest even. Magnitudes below the smallest normal half flush to zero.
+GLushort toHalf(GLfloat value)
+{
+   uint32_t bits = 0;
+   std::memcpy(&bits, &value, sizeof(bits));
+   const uint32_t sign = bits >> 16 & 0x8000;
+   const int exponent = int(bits >> 23 & 0xFF) - 127 + 15;
+   if (exponent <= 0)
+      return GLushort(sign);
+   if (exponent >= 31)
+      return GLushort(sign | 0x7C00);
+   uint32_t half = sign | uint32_t(exponent) << 10 | (bits & 0x7FFFFF) >> 13;
+   const uint32_t rest = bits & 0x1FFF;
+   if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+      ++half;
+   return GLushort(half);
+}
+
+GLfloat fromHalf(GLushort half)
+{
+   const int exponent = half >> 10 & 31;
+   const GLfloat magnitude = exponent ? std::ldexp(GLfloat(1024 + (half & 1023)), exponent - 25) : std::ldexp(GLfloat(half & 1023), -24);
+   return half & 0x8000 ? -magnitude : magnitude;
+}
+
+// Misses of a FIFO post-transform cache over indexed triangles, lines or points.
+template <typename Index>
+size_t vertexCacheMisses(const Index* indices, size_t count, size_t cacheSize = 16)
+{
+   std::deque<Index> cache;
+   size_t misses = 0;
+   for (size_t i = 0; i < count; ++i)
+   {
+      if (std::find(cache.begin(), cache.end(), indices[i]) != cache.end())
+         continue;
+      ++misses;
+      cache.push_back(indices[i]);
+      if (cache.size() > cacheSize)
+         cache.pop_front();
+   }
+   return misses;
+}
+
+// Tom Forsyth's linear-speed vertex cache optimisation: greedily emits the triangle whose
+// vertices score best, favouring vertices recently used and those with few triangles left.
+void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount)
+{
+   constexpr int cacheSize = 32;
+   const size_t triangles = indices.size() / 3;
+   const auto score = [](int position, uint32_t live) {
+      if (!live)
+         return -1.0f;
+      float result = 0;
+      if (position >= 0)
+         result = position < 3 ? 0.75f : std::pow(1 - float(position - 3) / (cacheSize - 3), 1.5f);
+      return result + 2 / std::sqrt(float(live));
+   };
+
+   // Triangles not yet emitted, per vertex.
+   std::vector<uint32_t> offsets(vertexCount + 1);
+   std::vector<uint32_t> live(vertexCount);
+   std::vector<uint32_t> adjacent(indices.size());
+   for (GLuint index : indices)
+      ++offsets[index + 1];
+   for (size_t v = 0; v < vertexCount; ++v)
+      offsets[v + 1] += offsets[v];
+   for (size_t i = 0; i < indices.size(); ++i)
+      adjacent[offsets[indices[i]] + live[indices[i]]++] = uint32_t(i / 3);
+
+   std::vector<int> cachePosition(vertexCount, -1);
+   std::vector<float> vertexScore(vertexCount);
+   for (size_t v = 0; v < vertexCount; ++v)
+      vertexScore[v] = score(-1, live[v]);
+   std::vector<float> triangleScore(triangles);
+   for (size_t t = 0; t < triangles; ++t)
+      triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+   std::vector<bool> emitted(triangles);
+   std::vector<GLuint> output;
+   output.reserve(indices.size());
+   std::vector<GLuint> cache;
+   std::vector<GLuint> next;
+   size_t cursor = 0;
+   size_t best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+   while (best < triangles)
+   {
+      emitted[best] = true;
+      const GLuint* corners = &indices[best * 3];
+      output.insert(output.end(), corners, corners + 3);
+
+      next.assign(corners, corners + 3);
+      for (GLuint v : cache)
+         if (v != corners[0] && v != corners[1] && v != corners[2])
+            next.push_back(v);
+      for (int k = 0; k < 3; ++k)
+      {
+         const GLuint v = corners[k];
+         uint32_t* first = &adjacent[offsets[v]];
+         std::swap(*std::find(first, first + live[v], uint32_t(best)), first[live[v] - 1]);
+         --live[v];
+      }
+
+      // Vertices pushed out of the cache are rescored too, before they are dropped.
+      for (size_t i = 0; i < next.size(); ++i)
+      {
+         cachePosition[next[i]] = i < size_t(cacheSize) ? int(i) : -1;
+         vertexScore[next[i]] = score(cachePosition[next[i]], live[next[i]]);
+      }
+      best = triangles;
+      float bestScore = -1;
+      for (GLuint v : next)
+      {
+         for (uint32_t i = offsets[v]; i < offsets[v] + live[v]; ++i)
+         {
+            const uint32_t t = adjacent[i];
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+            if (triangleScore[t] > bestScore)
+            {
+               best = t;
+               bestScore = triangleScore[t];
+            }
+         }
+      }
+      next.resize((std::min)(next.size(), size_t(cacheSize)));
+      cache.swap(next);
+
+      if (best == triangles)
+      {
+         while (cursor < triangles && emitted[cursor])
+            ++cursor;
+         best = cursor;
+      }
+   }
+   indices.swap(output);
+}
+
+// Interleaved position, optional texture coordinates and normalized 8-bit colour, indexed
+// with the narrowest type that fits. Render draws the opaque or the translucent batches from
+// buffer objects, one pair per share group like the floor's; Draw draws everything from
+// client arrays for display lists to capture.
+class PackedMesh
+{
+public:
+
+   enum class Format { Float, Half };
+
+   struct Batch
+   {
+      GLenum mode;
+      bool translucent;
+      size_t first;
+      size_t count;
+      size_t triangles;
+   };
+
+   PackedMesh(Format format, bool textured, std::vector<GLubyte> vertices, const std::vector<GLuint>& indices, std::vector<Batch> batches)
+      : m_format(format), m_textured(textured), m_vertices(std::move(vertices)), m_batches(std::move(batches))
+   {
+      m_stride = GetStride(format, textured);
+      if (m_vertices.size() / m_stride <= 0x10000)
+      {
+         m_indexType = GL_UNSIGNED_SHORT;
+         m_indices.resize(indices.size() * sizeof(GLushort));
+         for (size_t i = 0; i < indices.size(); ++i)
+         {
+            const GLushort index = GLushort(indices[i]);
+            std::memcpy(&m_indices[i * sizeof(index)], &index, sizeof(index));
+         }
+      }
+      else
+      {
+         m_indexType = GL_UNSIGNED_INT;
+         m_indices.resize(indices.size() * sizeof(GLuint));
+         std::memcpy(m_indices.data(), indices.data(), m_indices.size());
+      }
+   }
+
+   ~PackedMesh()
+   {
+      for (auto&& [group, buffers] : m_buffers)
+      {
+         glResources.Release(GLResourceType::Buffer, buffers.vertices, group);
+         glResources.Release(GLResourceType::Buffer, buffers.indices, group);
+      }
+   }
+
+   // Half positions are padded to four bytes so the colour stays aligned.
+   static size_t GetPositionSize(Format format) { return format == Format::Half ? 8 : 12; }
+   static size_t GetStride(Format format, bool textured) { return GetPositionSize(format) + (textured ? 8 : 0) + 4; }
+
+   Format GetFormat() const { return m_format; }
+   size_t GetStride() const { return m_stride; }
+   size_t GetVertexCount() const { return m_vertices.size() / m_stride; }
+   size_t GetIndexSize() const { return m_indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint); }
+   size_t GetSize() const { return m_vertices.size() + m_indices.size(); }
+   size_t GetTriangles() const { return GetTriangles(false) + GetTriangles(true); }
+
+   size_t GetTriangles(bool translucent) const
+   {
+      size_t triangles = 0;
+      for (auto&& batch : m_batches)
+         triangles += batch.translucent == translucent ? batch.triangles : 0;
+      return triangles;
+   }
+
+   bool HasBatches(bool translucent) const
+   {
+      return std::any_of(m_batches.begin(), m_batches.end(), [translucent](auto&& batch) { return batch.translucent == translucent; });
+   }
+
+   void GetPosition(size_t vertex, GLfloat* position) const
+   {
+      const GLubyte* data = &m_vertices[vertex * m_stride];
+      for (int k = 0; k < 3; ++k)
+      {
+         if (m_format == Format::Half)
+            position[k] = fromHalf(reinterpret_cast<const GLushort*>(data)[k]);
+         else
+            position[k] = reinterpret_cast<const GLfloat*>(data)[k];
+      }
+   }
+
+   // Post-transform cache misses per triangle over the triangle batches.
+   double GetCacheMissRatio(size_t cacheSize = 16) const
+   {
+      size_t misses = 0;
+      size_t count = 0;
+      for (auto&& batch : m_batches)
+      {
+         if (batch.mode != GL_TRIANGLES)
+            continue;
+         const GLubyte* first = m_indices.data() + batch.first * GetIndexSize();
+         misses += m_indexType == GL_UNSIGNED_SHORT ? vertexCacheMisses(reinterpret_cast<const GLushort*>(first), batch.count, cacheSize)
+            : vertexCacheMisses(reinterpret_cast<const GLuint*>(first), batch.count, cacheSize);
+         count += batch.count;
+      }
+      return count ? double(misses) * 3 / count : 0;
+   }
+
+   // Not every driver keeps half positions that were compiled into a list; see Render.
+   void Draw() const
+   {
+      drawnTriangles += GetTriangles();
+      draw(m_vertices.data(), m_indices.data(), false);
+      draw(m_vertices.data(), m_indices.data(), true);
+   }
+
+   // Needs glExt, and GL_ARB_half_float_vertex for half positions.
+   void Render(bool translucent) const
+   {
+      const auto& buffers = getBuffers();
+      glExt.BindBuffer(GL_ARRAY_BUFFER, buffers.vertices);
+      glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indices);
+      draw(nullptr, nullptr, translucent);
+      glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      glExt.BindBuffer(GL_ARRAY_BUFFER, 0);
+   }
+
+private:
+
+   struct Buffers
+   {
+      GLuint vertices = 0;
+      GLuint indices = 0;
+   };
+
+   void draw(const GLubyte* vertices, const GLubyte* indices, bool translucent) const
+   {
+      glEnableClientState(GL_VERTEX_ARRAY);
+      glEnableClientState(GL_COLOR_ARRAY);
+      glVertexPointer(3, m_format == Format::Half ? GL_HALF_FLOAT : GL_FLOAT, GLsizei(m_stride), vertices);
+      if (m_textured)
+      {
+         glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+         glTexCoordPointer(2, GL_FLOAT, GLsizei(m_stride), vertices + GetPositionSize(m_format));
+      }
+      glColorPointer(4, GL_UNSIGNED_BYTE, GLsizei(m_stride), vertices + m_stride - 4);
+      for (auto&& batch : m_batches)
+      {
+         if (batch.translucent == translucent)
+            glDrawElements(batch.mode, GLsizei(batch.count), m_indexType, indices + batch.first * GetIndexSize());
+      }
+      if (m_textured)
+         glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+      glDisableClientState(GL_COLOR_ARRAY);
+      glDisableClientState(GL_VERTEX_ARRAY);
+   }
+
+   const Buffers& getBuffers() const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto& buffers = m_buffers[glResources.GetGroup()];
+      if (!buffers.vertices)
+      {
+         buffers.vertices = glResources.Allocate(GLResourceType::Buffer);
+         buffers.indices = glResources.Allocate(GLResourceType::Buffer);
+
+         glExt.BindBuffer(GL_ARRAY_BUFFER, buffers.vertices);
+         glExt.BufferData(GL_ARRAY_BUFFER, GLsizeiptr(m_vertices.size()), m_vertices.data(), GL_STATIC_DRAW);
+         glResources.SetBytes(GLResourceType::Buffer, buffers.vertices, m_vertices.size());
+         glExt.BindBuffer(GL_ARRAY_BUFFER, 0);
+         glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indices);
+         glExt.BufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(m_indices.size()), m_indices.data(), GL_STATIC_DRAW);
+         glResources.SetBytes(GLResourceType::Buffer, buffers.indices, m_indices.size());
+         glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+         glFinish();
+      }
+      return buffers;
+   }
+
+private:
+   Format m_format;
+   bool m_textured;
+   size_t m_stride;
+   GLenum m_indexType;
+   std::vector<GLubyte> m_vertices;
+   std::vector<GLubyte> m_indices;
+   std::vector<Batch> m_batches;
+   mutable std::map<GLShareGroup, Buffers> m_buffers;
+   mutable std::mutex m_mutex;
+};
+
+// Collects geometry the way immediate mode issues it, or as whole quadric meshes, under a
+// current transform, and bakes it into a PackedMesh: duplicate vertices merged into one
+// index buffer, triangles reordered for the post-transform cache and vertices renumbered in
+// order of first use. Primitives with a vertex alpha below one form the translucent batches.
+// Triangles are drawn before lines and points.
+class MeshBuilder
+{
+public:
+
+   void SetTransform(const Matrix4& transform) { m_transform = transform; }
+
+   void Color(GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1)
+   {
+      const GLfloat rgba[4]{r, g, b, a};
+      for (int k = 0; k < 4; ++k)
+         m_color[k] = GLubyte(std::lround((std::min)(1.0f, (std::max)(0.0f, rgba[k])) * 255));
+   }
+
+   void TexCoord(GLfloat s, GLfloat t)
+   {
+      m_texCoord[0] = s;
+      m_texCoord[1] = t;
+      m_textured = true;
+   }
+
+   // GL_TRIANGLES, GL_QUADS, GL_LINES or GL_POINTS.
+   void Begin(GLenum mode)
+   {
+      m_mode = mode;
+      m_first = m_vertices.size();
+   }
+
+   void Vertex(GLfloat x, GLfloat y, GLfloat z)
+   {
+      add(x, y, z);
+   }
+
+   void End()
+   {
+      const bool quads = m_mode == GL_QUADS;
+      const GLuint corners = quads ? 4 : m_mode == GL_TRIANGLES ? 3 : m_mode == GL_LINES ? 2 : 1;
+      for (GLuint k = GLuint(m_first); k + corners <= m_vertices.size(); k += corners)
+      {
+         bool translucent = false;
+         for (GLuint i = k; i < k + corners; ++i)
+            translucent |= m_vertices[i].color[3] < 255;
+         auto& group = getGroup(quads ? GL_TRIANGLES : m_mode, translucent);
+         if (quads)
+            group.indices.insert(group.indices.end(), {k, k + 1, k + 2, k, k + 2, k + 3});
+         else
+            for (GLuint i = k; i < k + corners; ++i)
+               group.indices.push_back(i);
+         group.triangles += quads ? 2 : m_mode == GL_TRIANGLES ? 1 : 0;
+      }
+   }
+
+   // The mesh's normals are dropped; nothing in the scene is lit.
+   void Add(const QuadricMesh& mesh)
+   {
+      const GLuint first = GLuint(m_vertices.size());
+      for (auto&& vertex : mesh.GetVertices())
+         add(vertex.position[0], vertex.position[1], vertex.position[2]);
+      auto& group = getGroup(mesh.GetMode(), m_color[3] < 255);
+      for (GLushort index : mesh.GetIndices())
+         group.indices.push_back(first + index);
+      group.triangles += mesh.GetTriangles();
+   }
+
+   size_t GetVertexCount() const { return m_vertices.size(); }
+
+   size_t GetIndexCount() const
+   {
+      size_t count = 0;
+      for (auto&& group : m_groups)
+         count += group.indices.size();
+      return count;
+   }
+
+   std::shared_ptr<const PackedMesh> Build(PackedMesh::Format format, bool optimize = true) const
+   {
+      const size_t stride = PackedMesh::GetStride(format, m_textured);
+      const size_t positionSize = PackedMesh::GetPositionSize(format);
+      std::vector<GLubyte> packed(m_vertices.size() * stride);
+      for (size_t i = 0; i < m_vertices.size(); ++i)
+      {
+         GLubyte* target = &packed[i * stride];
+         const auto& vertex = m_vertices[i];
+         if (format == PackedMesh::Format::Half)
+         {
+            const GLushort half[4]{toHalf(vertex.position[0]), toHalf(vertex.position[1]), toHalf(vertex.position[2]), 0};
+            std::memcpy(target, half, sizeof(half));
+         }
+         else
+            std::memcpy(target, vertex.position, sizeof(vertex.position));
+         if (m_textured)
+            std::memcpy(target + positionSize, vertex.texCoord, sizeof(vertex.texCoord));
+         std::memcpy(target + stride - 4, vertex.color, sizeof(vertex.color));
+      }
+
+      // Open addressing over the packed bytes, so vertices that only differed below the
+      // precision of the format merge as well.
+      std::vector<GLuint> remap(m_vertices.size());
+      std::vector<GLubyte> unique;
+      size_t slots = 16;
+      while (slots < m_vertices.size() * 2)
+         slots *= 2;
+      std::vector<GLuint> table(slots, GLuint(-1));
+      for (size_t i = 0; i < m_vertices.size(); ++i)
+      {
+         const GLubyte* vertex = &packed[i * stride];
+         uint64_t hash = 14695981039346656037ull;
+         for (size_t k = 0; k < stride; ++k)
+            hash = (hash ^ vertex[k]) * 1099511628211ull;
+         size_t slot = size_t(hash) & (slots - 1);
+         while (table[slot] != GLuint(-1) && std::memcmp(&unique[table[slot] * stride], vertex, stride) != 0)
+            slot = (slot + 1) & (slots - 1);
+         if (table[slot] == GLuint(-1))
+         {
+            table[slot] = GLuint(unique.size() / stride);
+            unique.insert(unique.end(), vertex, vertex + stride);
+         }
+         remap[i] = table[slot];
+      }
+      const size_t vertexCount = unique.size() / stride;
+
+      // Primitives that collapsed onto a repeated vertex, such as those at a sphere's poles, go.
+      std::vector<Group> batches;
+      for (auto&& [mode, translucent, source, triangles] : m_groups)
+      {
+         const size_t corners = mode == GL_TRIANGLES ? 3 : mode == GL_LINES ? 2 : 1;
+         std::vector<GLuint> indices;
+         indices.reserve(source.size());
+         for (size_t i = 0; i + corners <= source.size(); i += corners)
+         {
+            GLuint primitive[3]{};
+            for (size_t k = 0; k < corners; ++k)
+               primitive[k] = remap[source[i + k]];
+            const bool degenerate = corners > 1 && (primitive[0] == primitive[1] || (corners == 3 && (primitive[1] == primitive[2] || primitive[0] == primitive[2])));
+            if (!degenerate)
+               indices.insert(indices.end(), primitive, primitive + corners);
+         }
+         if (optimize && mode == GL_TRIANGLES)
+            optimizeVertexCache(indices, vertexCount);
+         batches.push_back({mode, translucent, std::move(indices), triangles});
+      }
+
+      std::vector<GLuint> order(vertexCount, GLuint(-1));
+      std::vector<GLubyte> vertices;
+      vertices.reserve(unique.size());
+      std::vector<GLuint> indices;
+      std::vector<PackedMesh::Batch> ranges;
+      for (auto&& batch : batches)
+      {
+         ranges.push_back({batch.mode, batch.translucent, indices.size(), batch.indices.size(), batch.triangles});
+         for (GLuint index : batch.indices)
+         {
+            if (optimize && order[index] == GLuint(-1))
+            {
+               order[index] = GLuint(vertices.size() / stride);
+               vertices.insert(vertices.end(), &unique[index * stride], &unique[index * stride] + stride);
+            }
+            indices.push_back(optimize ? order[index] : index);
+         }
+      }
+      if (!optimize)
+         vertices.swap(unique);
+      return std::make_shared<const PackedMesh>(format, m_textured, std::move(vertices), indices, std::move(ranges));
+   }
+
+private:
+
+   struct Group
+   {
+      GLenum mode;
+      bool translucent;
+      std::vector<GLuint> indices;
+      size_t triangles;
+   };
+
+   struct Input
+   {
+      GLfloat position[3];
+      GLfloat texCoord[2];
+      GLubyte color[4];
+   };
+
+   void add(GLfloat x, GLfloat y, GLfloat z)
+   {
+      const auto& m = m_transform;
+      Input vertex{{
+         m[0] * x + m[4] * y + m[8] * z + m[12],
+         m[1] * x + m[5] * y + m[9] * z + m[13],
+         m[2] * x + m[6] * y + m[10] * z + m[14]},
+         {m_texCoord[0], m_texCoord[1]}, {}};
+      std::copy_n(m_color, 4, vertex.color);
+      m_vertices.push_back(vertex);
+   }
+
+   Group& getGroup(GLenum mode, bool translucent)
+   {
+      for (auto&& group : m_groups)
+         if (group.mode == mode && group.translucent == translucent)
+            return group;
+      m_groups.push_back({mode, translucent, {}, 0});
+      std::sort(m_groups.begin(), m_groups.end(), [](auto&& a, auto&& b) {
+         return a.translucent != b.translucent ? b.translucent : a.mode > b.mode;
+      });
+      return getGroup(mode, translucent);
+   }
+
+private:
+   Matrix4 m_transform = translation(0, 0, 0);
+   GLubyte m_color[4]{255, 255, 255, 255};
+   GLfloat m_texCoord[2]{};
+   bool m_textured = false;
+   GLenum m_mode = GL_TRIANGLES;
+   size_t m_first = 0;
+   std::vector<Input> m_vertices;
+   std::vector<Group> m_groups;
+};
+
+// Values live in one dense array, so walking them is a linear scan. Handles carry a generation
+// that is bumped whenever their slot is freed, so a stale handle never reaches a recycled slot.
+template <typename T>
+class SlotMap
+{
+public:
+
+   struct Handle
+   {
+      uint32_t index = invalid;
+      uint32_t generation = 0;
+   };
+
+   Handle Add(T value)
+   {
+      uint32_t index = 0;
+      if (m_free.empty())
+      {
+         index = uint32_t(m_slots.size());
+         m_slots.push_back({});
+      }
+      else
+      {
+         index = m_free.back();
+         m_free.pop_back();
+      }
+      m_slots[index].dense = uint32_t(m_values.size());
+      m_values.push_back(std::move(value));
+      m_owners.push_back(index);
+      return {index, m_slots[index].generation};
+   }
+
+   // Inside ForEach the removal is put off until the walk is over.
+   bool Remove(Handle handle)
+   {
+      if (!Get(handle))
+         return false;
+
+      if (m_iterating)
+      {
+         m_pending.push_back(handle);
+         return true;
+      }
+
+      auto& slot = m_slots[handle.index];
+      const uint32_t last = uint32_t(m_values.size() - 1);
+      if (slot.dense != last)
+      {
+         m_values[slot.dense] = std::move(m_values[last]);
+         m_owners[slot.dense] = m_owners[last];
+         m_slots[m_owners[slot.dense]].dense = slot.dense;
+      }
+      m_values.pop_back();
+      m_owners.pop_back();
+      slot.dense = invalid;
+      ++slot.generation;
+      m_free.push_back(handle.index);
+      return true;
+   }
+
+   T* Get(Handle handle)
+   {
+      if (handle.index >= m_slots.size())
+         return nullptr;
+      const auto& slot = m_slots[handle.index];
+      return slot.generation == handle.generation && slot.dense != invalid ? &m_values[slot.dense] : nullptr;
+   }
+
+   size_t size() const { return m_values.size(); }
+
+   // f(handle, value) may remove any entry but must not add new ones.
+   template <typename F>
+   void ForEach(F&& f)
+   {
+      m_iterating = true;
+      for (size_t i = 0; i < m_values.size(); ++i)
+         f(Handle{m_owners[i], m_slots[m_owners[i]].generation}, m_values[i]);
+      m_iterating = false;
+
+      for (auto&& handle : m_pending)
+         Remove(handle);
+      m_pending.clear();
+   }
+
+private:
+   static constexpr uint32_t invalid = ~uint32_t(0);
+
+   struct Slot
+   {
+      uint32_t dense = invalid;
+      uint32_t generation = 0;
+   };
+
+   std::vector<T> m_values;
+   std::vector<uint32_t> m_owners;
+   std::vector<Slot> m_slots;
+   std::vector<uint32_t> m_free;
+   std::vector<Handle> m_pending;
+   bool m_iterating = false;
+};
+
+// Per-window side of the texture cache. A requested texture gets its name at once, holding a
+// placeholder, so display lists can bind it right away. Pump then streams ready entries into
+// their names through a ring of pixel buffers, within a per-frame budget. Uploads still pending
+// when the window closes are handed to the next window of its share group that pumps, as the
+// other windows only look the name up and would keep the placeholder.
+class TextureUploader
+{
+public:
+
+   TextureUploader() = default;
+   TextureUploader(const TextureUploader&) = delete;
+
+   ~TextureUploader() { Close(); }
+
+   // Call while the window's context is still attached. The last context of a group takes the
+   // uploads handed off to it along.
+   void Close()
+   {
+      for (auto&& pbo : m_pbos)
+      {
+         glResources.Release(GLResourceType::Buffer, pbo.name, m_group);
+         pbo = {};
+      }
+
+      std::lock_guard<std::mutex> lock(m_handedOffMutex);
+      if (glResources.GetMembers(m_group) > 1)
+         m_handedOff[m_group].splice(m_handedOff[m_group].end(), m_uploads);
+      else
+         m_handedOff.erase(m_group);
+      m_uploads.clear();
+   }
+
+   // The group of the window's context, so that uploads handed off to it are seen before the
+   // window requests anything itself.
+   void SetGroup(GLShareGroup group) { m_group = group; }
+
+   GLuint Request(const TextureCache::EntryPtr& entry)
+   {
+      m_group = glResources.GetGroup();
+      const GLuint name = glResources.Allocate(GLResourceType::Texture);
+      glResources.Register(entry->GetKey(), name);
+
+      static const GLubyte placeholder[]{
+         255, 0, 255, 255, 96, 96, 96, 255,
+         96, 96, 96, 255, 255, 0, 255, 255,
+      };
+      glBindTexture(GL_TEXTURE_2D, name);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glResources.SetBytes(GLResourceType::Texture, name, sizeof(placeholder));
+
+      m_uploads.push_back({entry, name});
+      return name;
+   }
+
+   // Returns the number of bytes uploaded.
+   size_t Pump(size_t budget)
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_handedOffMutex);
+         const auto found = m_handedOff.find(m_group);
+         if (found != m_handedOff.end())
+         {
+            m_uploads.splice(m_uploads.end(), found->second);
+            m_handedOff.erase(found);
+         }
+      }
+
+      size_t uploaded = 0;
+      for (auto it = m_uploads.begin(); it != m_uploads.end() && uploaded < budget; )
+      {
+         if (!it->entry->IsReady())
+         {
+            ++it;
+            continue;
+         }
+
+         uploaded += upload(*it, budget - uploaded);
+         if (it->done)
+            it = m_uploads.erase(it);
+      }
+      return uploaded;
+   }
+
+   // Includes uploads handed off to the share group, which the next Pump takes over.
+   size_t GetPending() const
+   {
+      std::lock_guard<std::mutex> lock(m_handedOffMutex);
+      const auto found = m_handedOff.find(m_group);
+      return m_uploads.size() + (found != m_handedOff.end() ? found->second.size() : 0);
+   }
+
+private:
+
+   struct Upload
+   {
+      TextureCache::EntryPtr entry;
+      GLuint name = 0;
+      int level = -1;
+      LONG row = -1;
+      bool done = false;
+   };
+
+   // Levels go coarsest first. Each finished level becomes the base level, so the texture is
+   // always complete and sharpens as finer levels arrive.
+   size_t upload(Upload& upload, size_t budget)
+   {
+      // A bitmap that failed to load has no rows to slice; it keeps the placeholder.
+      const auto& texture = upload.entry->GetTexture();
+      const int levels = texture ? int(texture.GetLevelCount()) : 0;
+      if (!levels || (texture.IsCompressed() && !glExt.HasS3tc()))
+      {
+         if (levels)
+            logger.Write<LogLevel::Warning>(LogCategory::Texture, "no S3TC support for", upload.entry->GetKey());
+         upload.done = true;
+         return 0;
+      }
+
+      glBindTexture(GL_TEXTURE_2D, upload.name);
+      if (upload.level < 0)
+      {
+         upload.level = levels - 1;
+         glResources.SetBytes(GLResourceType::Texture, upload.name, texture.GetStorageBytes());
+      }
+
+      const auto& level = texture.GetLevel(upload.level);
+      if (upload.row < 0)
+      {
+         if (!texture.IsCompressed())
+         {
+            glTexImage2D(GL_TEXTURE_2D, upload.level, texture.HasAlpha() ? GL_RGBA : GL_RGB, level.width,
+               level.height, 0, texture.GetPixelFormat(), GL_UNSIGNED_BYTE, nullptr);
+         }
+         upload.row = 0;
+      }
+
+      // Compressed levels go in one piece, uncompressed ones a slice of rows at a time.
+      const size_t stride = level.size / level.height;
+      const LONG rows = texture.IsCompressed() ? level.height
+         : LONG((std::min)(size_t(level.height - upload.row), (std::max)(size_t(1), budget / stride)));
+      const size_t bytes = texture.IsCompressed() ? level.size : rows * stride;
+      const byte* pixels = texture.GetLevelData(upload.level) + upload.row * stride;
+      if (glExt)
+      {
+         // Orphaning the buffer and cycling through the ring keeps the copy from waiting on
+         // a transfer that is still in flight.
+         auto& pbo = m_pbos[m_nextPbo];
+         m_nextPbo = (m_nextPbo + 1) % m_pbos.size();
+         if (!pbo.name)
+            pbo.name = glResources.Allocate(GLResourceType::Buffer);
+         glExt.BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo.name);
+         glExt.BufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(bytes), nullptr, GL_STREAM_DRAW);
+         if (bytes > pbo.bytes)
+            glResources.SetBytes(GLResourceType::Buffer, pbo.name, pbo.bytes = bytes);
+         if (void* const mapped = glExt.MapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY))
+         {
+            std::memcpy(mapped, pixels, bytes);
+            glExt.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            pixels = nullptr;
+         }
+         else
+         {
+            glExt.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+         }
+      }
+      if (texture.IsCompressed())
+      {
+         glExt.CompressedTexImage2D(GL_TEXTURE_2D, upload.level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+            level.width, level.height, 0, GLsizei(bytes), pixels);
+      }
+      else
+      {
+         glTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, upload.row, level.width, rows, texture.GetPixelFormat(), GL_UNSIGNED_BYTE, pixels);
+      }
+      if (glExt)
+         glExt.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+      upload.row += rows;
+      if (upload.row == level.height)
+      {
+         if (levels > 1)
+         {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, upload.level);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+         }
+         upload.done = upload.level == 0;
+         --upload.level;
+         upload.row = -1;
+      }
+      glBindTexture(GL_TEXTURE_2D, 0);
+      return bytes;
+   }
+
+private:
+
+   struct Pbo
+   {
+      GLuint name = 0;
+      size_t bytes = 0;
+   };
+
+   static std::map<GLShareGroup, std::list<Upload>> m_handedOff;
+   static std::mutex m_handedOffMutex;
+   GLShareGroup m_group = 0;
+   std::list<Upload> m_uploads;
+   std::array<Pbo, 3> m_pbos{};
+   size_t m_nextPbo = 0;
+};
+
+std::map<GLShareGroup, std::list<TextureUploader::Upload>> TextureUploader::m_handedOff;
+std::mutex TextureUploader::m_handedOffMutex;
+
+// Reads frames back through a ring of pixel pack buffers. glReadPixels into a buffer returns at
+// once, and a slot is only mapped when the ring comes round to it again, frames later, when the
+// copy has long finished. A writer thread streams the frames to disk, one file per frame, either
+// as binary PPM or as raw top-down BGRA.
+class FrameCapture
+{
+public:
+
+   enum class Format { Raw, Ppm };
+
+   struct Stats
+   {
+      size_t captured = 0;
+      size_t written = 0;
+      // Frames whose buffer could not be mapped; they are never written.
+      size_t dropped = 0;
+      size_t bytes = 0;
+      // Time Capture spent waiting for the writer to make room.
+      double stallSeconds = 0;
+   };
+
+   FrameCapture(std::string prefix, Format format, size_t depth = 3)
+      : m_prefix(std::move(prefix)), m_format(format), m_slots((std::max)(size_t(1), depth))
+   {
+      m_writer = std::thread([this] { writeLoop(); });
+   }
+
+   FrameCapture(const FrameCapture&) = delete;
+
+   ~FrameCapture()
+   {
+      for (auto&& slot : m_slots)
+         glResources.Release(GLResourceType::Buffer, slot.name, m_group);
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_stop = true;
+      }
+      m_wake.notify_all();
+      m_writer.join();
+   }
+
+   // With the context current and the frame drawn into the bound framebuffer.
+   void Capture(GLsizei width, GLsizei height)
+   {
+      auto& slot = m_slots[m_next];
+      m_next = (m_next + 1) % m_slots.size();
+      if (slot.pending)
+         retire(slot);
+
+      const size_t bytes = size_t(width) * height * 4;
+      if (!glExt)
+      {
+         Frame frame{m_captured++, width, height, takeBuffer(bytes)};
+         glReadPixels(0, 0, width, height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, frame.pixels.data());
+         push(std::move(frame));
+         return;
+      }
+
+      m_group = glResources.GetGroup();
+      if (!slot.name)
+         slot.name = glResources.Allocate(GLResourceType::Buffer);
+      glExt.BindBuffer(GL_PIXEL_PACK_BUFFER, slot.name);
+      if (bytes != slot.bytes)
+      {
+         glExt.BufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(bytes), nullptr, GL_STREAM_READ);
+         glResources.SetBytes(GLResourceType::Buffer, slot.name, slot.bytes = bytes);
+      }
+      glReadPixels(0, 0, width, height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, nullptr);
+      glExt.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      slot.index = m_captured++;
+      slot.width = width;
+      slot.height = height;
+      slot.pending = true;
+   }
+
+   // Retires the frames still in the ring and waits until the writer has them all on disk.
+   void Finish()
+   {
+      for (size_t i = 0; i < m_slots.size(); ++i)
+      {
+         auto& slot = m_slots[(m_next + i) % m_slots.size()];
+         if (slot.pending)
+            retire(slot);
+      }
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_idle.wait(lock, [this] { return m_queue.empty() && !m_writing; });
+   }
+
+   Stats GetStats() const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto stats = m_stats;
+      stats.captured = m_captured;
+      return stats;
+   }
+
+private:
+
+   struct Slot
+   {
+      GLuint name = 0;
+      size_t bytes = 0;
+      size_t index = 0;
+      GLsizei width = 0;
+      GLsizei height = 0;
+      bool pending = false;
+   };
+
+   struct Frame
+   {
+      size_t index = 0;
+      GLsizei width = 0;
+      GLsizei height = 0;
+      std::vector<char> pixels;
+   };
+
+   // Frames the writer may fall behind by before Capture waits for it.
+   static constexpr size_t maxQueued = 8;
+
+   void retire(Slot& slot)
+   {
+      PROFILE_SCOPE("Map capture");
+      Frame frame{slot.index, slot.width, slot.height, takeBuffer(slot.bytes)};
+      glExt.BindBuffer(GL_PIXEL_PACK_BUFFER, slot.name);
+      if (const void* const mapped = glExt.MapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY))
+      {
+         std::memcpy(frame.pixels.data(), mapped, slot.bytes);
+         glExt.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+         push(std::move(frame));
+      }
+      else
+      {
+         logger.Write<LogLevel::Error>(LogCategory::Window, "cannot map captured frame", slot.index);
+         std::lock_guard<std::mutex> lock(m_mutex);
+         ++m_stats.dropped;
+         m_free.push_back(std::move(frame.pixels));
+      }
+      glExt.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      slot.pending = false;
+   }
+
+   std::vector<char> takeBuffer(size_t bytes)
+   {
+      std::vector<char> buffer;
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         if (!m_free.empty())
+         {
+            buffer = std::move(m_free.back());
+            m_free.pop_back();
+         }
+      }
+      buffer.resize(bytes);
+      return buffer;
+   }
+
+   void push(Frame frame)
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (m_queue.size() >= maxQueued)
+      {
+         const auto start = Clock::now();
+         m_idle.wait(lock, [this] { return m_queue.size() < maxQueued; });
+         m_stats.stallSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+      }
+      m_queue.push_back(std::move(frame));
+      m_wake.notify_one();
+   }
+
+   void writeLoop()
+   {
+      profiler.NameThread("capture");
+      for (;;)
+      {
+         Frame frame;
+         {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty())
+               return;
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_writing = true;
+         }
+
+         const size_t bytes = write(frame);
+         {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_stats.written;
+            m_stats.bytes += bytes;
+            m_free.push_back(std::move(frame.pixels));
+            m_writing = false;
+         }
+         m_idle.notify_all();
+      }
+   }
+
+   // GL rows go bottom-up, file rows top-down.
+   size_t write(const Frame& frame)
+   {
+      PROFILE_SCOPE("Write frame");
+      std::ostringstream path;
+      path << m_prefix << std::setw(6) << std::setfill('0') << frame.index << (m_format == Format::Ppm ? ".ppm" : ".raw");
+      std::ofstream output(path.str(), std::ios::binary);
+
+      const size_t stride = size_t(frame.width) * 4;
+      if (m_format == Format::Raw)
+      {
+         for (GLsizei y = frame.height; y-- > 0; )
+            output.write(frame.pixels.data() + y * stride, stride);
+         return output ? frame.pixels.size() : 0;
+      }
+
+      output << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+      m_row.resize(size_t(frame.width) * 3);
+      for (GLsizei y = frame.height; y-- > 0; )
+      {
+         const char* bgra = frame.pixels.data() + y * stride;
+         for (GLsizei x = 0; x < frame.width; ++x, bgra += 4)
+         {
+            m_row[x * 3] = bgra[2];
+            m_row[x * 3 + 1] = bgra[1];
+            m_row[x * 3 + 2] = bgra[0];
+         }
+         output.write(m_row.data(), m_row.size());
+      }
+      return output ? m_row.size() * frame.height : 0;
+   }
+
+private:
+   std::string m_prefix;
+   Format m_format;
+   std::vector<Slot> m_slots;
+   size_t m_next = 0;
+   std::atomic<size_t> m_captured{0};
+   GLShareGroup m_group = 0;
+   std::vector<char> m_row;
+   std::deque<Frame> m_queue;
+   std::vector<std::vector<char>> m_free;
+   bool m_writing = false;
+   bool m_stop = false;
+   Stats m_stats;
+   mutable std::mutex m_mutex;
+   std::condition_variable m_wake;
+   std::condition_variable m_idle;
+   std::thread m_writer;
+};
+
+// One display list per object and share group, compiled by whichever window of the group first
+// sees a new version and called by all of them.
+struct GLCompiledList
+{
+   GLShareGroup group = 0;
+   GLuint list = 0;
+   std::atomic<size_t> version{0};
+   std::atomic<size_t> triangles{0};
+   std::mutex mutex;
+   const IGLObject* owner = nullptr;
+   std::weak_ptr<IGLObject> object;
+
+   GLCompiledList() = default;
+   GLCompiledList(const GLCompiledList&) = delete;
+
+   ~GLCompiledList() { glResources.Release(GLResourceType::DisplayList, list, group); }
+};
+
+struct GLObjectEntry
+{
+   std::shared_ptr<GLCompiledList> compiled;
+   std::weak_ptr<IGLObject> object;
+};
+
+using GLObjectMap = SlotMap<GLObjectEntry>;
+
+struct CameraState
+{
+   double longitude = 0;
+   double latitude = 0;
+   double distance = 0;
+};
+
+class GLTestWindow
+{
+public:
+
+   GLTestWindow(const GLTestWindow&) = delete;
+
+   GLTestWindow(std::initializer_list<std::shared_ptr<IGLObject>> glObjects = {}) : GLTestWindow(glObjects, {}) { }
+
+   template <typename GLObjectRange>
+   GLTestWindow(const GLObjectRange& glObjects,
+      std::enable_if_t<IsCollectionOf<GLObjectRange, std::shared_ptr<IGLObject>>, int> = {})
+   {
+      CreateWindow(
+         m_wndClass.lpszClassName,
+         "Generic OpenGL Sample",
+         WS_OVERLAPPEDWINDOW | WS_CLIPSIBLINGS | WS_CLIPCHILDREN,
+         CW_USEDEFAULT,
+         CW_USEDEFAULT,
+         CW_USEDEFAULT, CW_USEDEFAULT,
+         nullptr,
+         nullptr,
+         m_wndClass.hInstance,
+         this);
+
+      if (m_hwnd)
+      {
+         m_hdc = GetDC(m_hwnd);
+         bSetupPixelFormat(m_hdc);
+         m_hrc = wglCreateContext(m_hdc);
+         m_textures.SetGroup(glResources.Attach(m_hrc, m_shareResources));
+         wglMakeCurrent(m_hdc, m_hrc);
+
+         if (!glExt)
+            glExt.Load();
+         m_queue.Reset();
+
+         RECT rect {};
+         GetClientRect(m_hwnd, &rect);
+         m_width = rect.right;
+         m_height = rect.bottom;
+         m_projection = setProjection(m_width, m_height);
+
+         for (auto&& glObject : glObjects)
+            AddGLObject(glObject);
+
+         ShowWindow(m_hwnd, SW_SHOW);
+         UpdateWindow(m_hwnd);
+      }
+   }
+
+   struct FrameStats
+   {
+      size_t listCompiles = 0;
+      size_t textureBytes = 0;
+      size_t pendingTextures = 0;
+      size_t culledObjects = 0;
+      size_t triangles = 0;
+      size_t stateChanges = 0;
+      size_t drawCalls = 0;
+      // Late-latched frames whose camera moved beyond the widened frustum.
+      size_t reculls = 0;
+      // Seconds from each input the frame shows to its swap.
+      std::vector<double> inputLatencies;
+   };
+
+   explicit operator bool() const { return m_hwnd; };
+
+   // Whether windows created from now on join the share group of the existing ones.
+   static void ShareResources(bool share) { m_shareResources = share; }
+
+   void Hide() { ShowWindow(m_hwnd, SW_HIDE); }
+
+   const FrameStats& GetFrameStats() const { return m_frameStats; }
+
+   void SetSwapInterval(int interval)
+   {
+      using SwapIntervalProc = BOOL (WINAPI*)(int);
+      wglMakeCurrent(m_hdc, m_hrc);
+      if (const auto swapInterval = reinterpret_cast<SwapIntervalProc>(wglGetProcAddress("wglSwapIntervalEXT")))
+         swapInterval(interval);
+   }
+
+   GLObjectMap::Handle AddGLObject(const std::shared_ptr<IGLObject>& glObject)
+   {
+      wglMakeCurrent(m_hdc, m_hrc);
+      return m_glObjects.Add({compiledList(glObject), glObject});
+   }
+
+   bool RemoveGLObject(GLObjectMap::Handle handle)
+   {
+      const auto entry = m_glObjects.Get(handle);
+      if (!entry)
+         return false;
+      const auto key = std::make_pair(entry->compiled->group, entry->compiled->owner);
+      entry->compiled.reset();
+      std::lock_guard<std::mutex> lock(m_compiledMutex);
+      const auto found = m_compiledLists.find(key);
+      if (found != m_compiledLists.end() && found->second.expired())
+         m_compiledLists.erase(found);
+      return m_glObjects.Remove(handle);
+   }
+
+   GLvoid Draw(double dt)
+   {
+      PROFILE_SCOPE("Draw");
+      m_damaged = false;
+      CameraState camera{};
+      if (!m_lateLatch)
+         camera = latchCamera(dt);
+
+      wglMakeCurrent(m_hdc, m_hrc);
+      if (m_framebuffer)
+         glExt.BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+      if (m_resized)
+      {
+         m_projection = setProjection(m_width, m_height);
+         m_resized = false;
+      }
+      m_gpuTimer.Begin();
+
+      glClearColor(0.1f, 0.1f, 0.3f, 1);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+      // Whatever does not depend on the camera comes first, so a late latch is late.
+      m_frameStats = {};
+      {
+         PROFILE_SCOPE("Upload textures");
+         m_frameStats.textureBytes = m_textures.Pump(m_uploadBudget);
+         m_frameStats.pendingTextures = m_textures.GetPending();
+      }
+      {
+         PROFILE_SCOPE("Compile lists");
+         m_glObjects.ForEach([this](GLObjectMap::Handle, GLObjectEntry& entry) {
+            const auto& glObject = entry.object.lock();
+            auto& compiled = *entry.compiled;
+            if (glObject && compiled.version != glObject->GetVersion())
+            {
+               std::lock_guard<std::mutex> lock(compiled.mutex);
+               if (compiled.version != glObject->GetVersion())
+               {
+                  compiled.triangles = Compile(*glObject, compiled.list);
+                  compiled.version = glObject->GetVersion();
+               }
+            }
+         });
+      }
+
+      PROFILE_SCOPE("Render objects");
+      const auto setView = [this](const CameraState& camera) {
+         const auto modelView = multiply(
+            multiply(translation(0, 0, GLfloat(-camera.distance)), rotation(camera.latitude, 1, 0, 0)),
+            multiply(rotation(camera.longitude, 0, 1, 0), translation(0, GLfloat(-m_viewLevel), 0)));
+         glMatrixMode(GL_MODELVIEW);
+         glLoadMatrixf(modelView.data());
+         m_view.Set(m_projection, modelView, m_height);
+      };
+      const auto submit = [this] {
+         m_view.culled = 0;
+         m_glObjects.ForEach([this](GLObjectMap::Handle handle, GLObjectEntry& entry) {
+            if (const auto& glObject = entry.object.lock())
+            {
+               const auto& compiled = *entry.compiled;
+               BoundingSphere bounds;
+               if (glObject->GetBounds(bounds) && !m_view.IsVisible(bounds))
+               {
+                  ++m_view.culled;
+                  return;
+               }
+               m_queue.Submit(glObject, compiled.list, compiled.triangles, m_view);
+            }
+            else
+            {
+               RemoveGLObject(handle);
+            }
+         });
+      };
+
+      // With a late latch, objects are culled and queued for the camera as it is now, in a
+      // frustum widened by what the camera can move in a frame, and the camera is latched right
+      // before the queue is drawn. A move beyond that, as a flick of the mouse can make, has the
+      // objects culled again. Items keep the depth order of the camera they were queued for.
+      m_view.triangles = 0;
+      if (m_lateLatch)
+      {
+         const auto predicted = peekCamera(dt);
+         setView(predicted);
+         const std::array<GLfloat, 3> pivot{0, GLfloat(m_viewLevel), 0};
+         m_view.SetSlack(GLfloat(latchSlackAngle * pi / 180), GLfloat(latchSlackDistance), pivot);
+         submit();
+         m_view.SetSlack(0, 0, pivot);
+
+         camera = latchCamera(dt);
+         setView(camera);
+         const double turn = std::abs(std::remainder(camera.longitude - predicted.longitude, 360.0))
+            + std::abs(camera.latitude - predicted.latitude);
+         if (turn > latchSlackAngle || std::abs(camera.distance - predicted.distance) > latchSlackDistance)
+         {
+            m_queue.Discard();
+            submit();
+            ++m_frameStats.reculls;
+         }
+      }
+      else
+      {
+         setView(camera);
+         submit();
+      }
+      m_queue.Flush(m_view);
+      m_frameStats.stateChanges = m_queue.GetStats().stateChanges;
+      m_frameStats.drawCalls = m_queue.GetStats().drawCalls;
+      m_frameStats.culledObjects = m_view.culled;
+      m_frameStats.triangles = m_view.triangles;
+      if (m_profileOverlay)
+         drawProfile();
+      m_gpuTimer.End();
+      if (m_capture)
+      {
+         PROFILE_SCOPE("Capture");
+         m_capture->Capture(m_width, m_height);
+      }
+      if (m_framebuffer)
+      {
+         glFlush();
+      }
+      else
+      {
+         PROFILE_SCOPE("SwapBuffers");
+         SwapBuffers(m_hdc);
+      }
+      const auto presented = Clock::now();
+      for (auto&& time : m_latchedInputs)
+         m_frameStats.inputLatencies.push_back(std::chrono::duration<double>(presented - time).count());
+      m_latchedInputs.clear();
+      glResources.Collect();
+   }
+
+   // Takes the camera right before the queued objects are drawn instead of when the frame starts,
+   // so that input handled while the frame uploads, compiles and culls still makes it into the
+   // frame. That saves what those steps take, not a frame: drawing the queue and the swap have to
+   // follow the latch, and under load they are most of the frame.
+   void SetLateLatch(bool lateLatch) { m_lateLatch = lateLatch; }
+
+   // Shows the profiler's averages over the scene, and keeps the profiler on while shown.
+   void ShowProfile(bool show)
+   {
+      if (m_profileOverlay.exchange(show) != show)
+         profiler.Hold(show);
+   }
+
+   // Display lists look the texture up by its key with glResources.Lookup. A placeholder is
+   // bound under the name until the decoded pixels have been streamed in. A key the share group
+   // already holds is not loaded again; the window that requested it first streams it, or the
+   // next one to draw should that window close first.
+   GLuint AddTexture(const std::string& key, TextureCache::Loader loader = {})
+   {
+      wglMakeCurrent(m_hdc, m_hrc);
+      glEnable(GL_TEXTURE_2D);
+      if (const GLuint name = glResources.Lookup(key))
+         return name;
+      return m_textures.Request(textureCache.Load(key, std::move(loader)));
+   }
+
+   // Only once the texture is resident, e.g. after FlushTextures.
+   void RemoveTexture(const std::string& key)
+   {
+      wglMakeCurrent(m_hdc, m_hrc);
+      textureCache.Evict(key);
+      glResources.Release(GLResourceType::Texture, glResources.Unregister(key), glResources.GetGroup());
+      glResources.Collect();
+   }
+
+   void SetUploadBudget(size_t bytes) { m_uploadBudget = bytes; }
+
+   // Draws only after something it shows has changed: an object's version, the camera, the
+   // size, input, pending textures, or an Invalidate() for things the window cannot see itself.
+   void SetRenderOnDemand(bool onDemand) { m_onDemand = onDemand; }
+
+   void Invalidate() { m_damaged = true; }
+
+   bool NeedsRedraw()
+   {
+      bool spinning = false;
+      {
+         std::lock_guard<std::mutex> lock(m_cameraMutex);
+         spinning = m_longinc != 0;
+      }
+      if (!m_onDemand || m_damaged || spinning || m_profileOverlay || m_textures.GetPending())
+         return true;
+      bool changed = false;
+      m_glObjects.ForEach([&changed](GLObjectMap::Handle, GLObjectEntry& entry) {
+         const auto& glObject = entry.object.lock();
+         changed |= !glObject || entry.compiled->version != glObject->GetVersion();
+      });
+      return changed;
+   }
+
+   CameraState GetCamera() const
+   {
+      std::lock_guard<std::mutex> lock(m_cameraMutex);
+      return {m_longitude, m_latitude, m_viewDistance};
+   }
+
+   // Also stops the camera's spin.
+   void SetCamera(const CameraState& camera)
+   {
+      std::lock_guard<std::mutex> lock(m_cameraMutex);
+      m_longitude = camera.longitude;
+      m_latitude = camera.latitude;
+      m_viewDistance = camera.distance;
+      m_longinc = 0;
+      m_damaged = true;
+   }
+
+   using InputHandler = std::function<void(UINT, WPARAM, LPARAM)>;
+
+   // Sees the mouse and keyboard messages before the window handles them.
+   void SetInputHandler(InputHandler handler) { m_inputHandler = std::move(handler); }
+
+   // Handles the message as if the user had just given it.
+   void ReplayInput(UINT message, WPARAM wParam, LPARAM lParam)
+   {
+      SendMessage(m_hwnd, message, wParam, lParam);
+   }
+
+   using KeyHandler = std::function<void(WPARAM)>;
+
+   // Gets the keys the window does not use itself.
+   void SetKeyHandler(KeyHandler handler) { m_keyHandler = std::move(handler); }
+
+   // Draws into a framebuffer object of the given size instead of the window from now on. The
+   // window and its WGL context are still needed, so this is hidden rendering, not headless.
+   bool SetOffscreen(GLsizei width, GLsizei height)
+   {
+      wglMakeCurrent(m_hdc, m_hrc);
+      if (!glExt.HasFramebuffer() || m_framebuffer)
+         return false;
+
+      // Framebuffers are per context, and the renderbuffers go with the context.
+      glExt.GenRenderbuffers(2, m_renderbuffers);
+      glExt.BindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[0]);
+      glExt.RenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+      glExt.BindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[1]);
+      glExt.RenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+      glExt.BindRenderbuffer(GL_RENDERBUFFER, 0);
+      glExt.GenFramebuffers(1, &m_framebuffer);
+      glExt.BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+      glExt.FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_renderbuffers[0]);
+      glExt.FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_renderbuffers[1]);
+      const bool complete = glExt.CheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+      glExt.BindFramebuffer(GL_FRAMEBUFFER, 0);
+      if (!complete)
+      {
+         glExt.DeleteFramebuffers(1, &m_framebuffer);
+         glExt.DeleteRenderbuffers(2, m_renderbuffers);
+         m_framebuffer = 0;
+         return false;
+      }
+
+      m_width = width;
+      m_height = height;
+      m_resized = true;
+      return true;
+   }
+
+   // Every frame drawn from now on is read back and written to <prefix><frame number>.
+   void StartCapture(const std::string& prefix, FrameCapture::Format format)
+   {
+      m_capture = std::make_unique<FrameCapture>(prefix, format);
+   }
+
+   // Writes out the frames still being read back. Not while the window is drawing.
+   void FinishCapture()
+   {
+      if (m_capture && m_hwnd)
+      {
+         wglMakeCurrent(m_hdc, m_hrc);
+         m_capture->Finish();
+      }
+   }
+
+   FrameCapture::Stats GetCaptureStats() const { return m_capture ? m_capture->GetStats() : FrameCapture::Stats{}; }
+
+   void SetCulling(bool cull) { m_view.cull = cull; }
+   void SetLevelOfDetail(bool levelOfDetail) { m_view.levelOfDetail = levelOfDetail; }
+   void SetViewDistance(double distance)
+   {
+      std::lock_guard<std::mutex> lock(m_cameraMutex);
+      m_viewDistance = distance;
+   }
+
+   // Blocks until every requested texture is decoded and resident.
+   void FlushTextures()
+   {
+      wglMakeCurrent(m_hdc, m_hrc);
+      while (m_textures.GetPending())
+      {
+         if (!m_textures.Pump(SIZE_MAX) && m_textures.GetPending())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      glFinish();
+   }
+
+   ~GLTestWindow()
+   {
+      ShowProfile(false);
+      if (m_hwnd)
+      {
+         DestroyWindow(m_hwnd);
+      }
+   }
+
+private:
+
+   std::shared_ptr<GLCompiledList> compiledList(const std::shared_ptr<IGLObject>& glObject)
+   {
+      const GLShareGroup group = glResources.GetGroup(m_hrc);
+      std::lock_guard<std::mutex> lock(m_compiledMutex);
+      auto& slot = m_compiledLists[{group, glObject.get()}];
+      if (auto compiled = slot.lock())
+      {
+         // The address may have been reused by a new object since.
+         if (compiled->object.lock() == glObject)
+            return compiled;
+      }
+
+      auto compiled = std::make_shared<GLCompiledList>();
+      compiled->group = group;
+      compiled->list = glResources.Allocate(GLResourceType::DisplayList);
+      compiled->owner = glObject.get();
+      compiled->object = glObject;
+      compiled->triangles = Compile(*glObject, compiled->list);
+      compiled->version = glObject->GetVersion();
+      slot = compiled;
+      return compiled;
+   }
+
+   // Returns the triangles the list draws.
+   size_t Compile(IGLObject& glObject, GLuint id)
+   {
+      if (!glObject.UsesList())
+         return 0;
+      PROFILE_SCOPE("Compile");
+      GLList list(id, GL_COMPILE);
+      const size_t before = drawnTriangles;
+      glObject.Draw();
+      ++m_frameStats.listCompiles;
+      return drawnTriangles - before;
+   }
+
+   // A bar per scope, scaled so that a 60 Hz frame fills 300 pixels, with the scope's name and
+   // average when the font could be made.
+   void drawProfile()
+   {
+      if (!m_font && !m_fontFailed)
+      {
+         // Lives as long as the context; the profiler has no place in the resource pools.
+         m_font = glGenLists(96);
+         m_fontFailed = !wglUseFontBitmaps(m_hdc, 32, 96, m_font);
+         if (m_fontFailed)
+         {
+            glDeleteLists(m_font, 96);
+            m_font = 0;
+         }
+      }
+
+      glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT | GL_POLYGON_BIT | GL_LIST_BIT);
+      glDisable(GL_DEPTH_TEST);
+      glDisable(GL_TEXTURE_2D);
+      glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+      glMatrixMode(GL_PROJECTION);
+      glPushMatrix();
+      glLoadIdentity();
+      glOrtho(0, m_width, 0, m_height, -1, 1);
+      glMatrixMode(GL_MODELVIEW);
+      glPushMatrix();
+      glLoadIdentity();
+
+      const auto averages = profiler.GetAverages();
+      const GLfloat left = 160;
+      const GLfloat scale = 300 / (1000 / 60.0f);
+      const GLfloat rowHeight = 16;
+      const GLfloat top = GLfloat(m_height) - 8;
+      glColor4f(0, 0, 0, 0.5f);
+      glRectf(4, top - rowHeight * averages.size() - 4, left + 320, top + 4);
+      for (size_t i = 0; i < averages.size(); ++i)
+      {
+         const auto& [name, ms] = averages[i];
+         const GLfloat y = top - rowHeight * (i + 1);
+         const size_t hash = std::hash<std::string>()(name);
+         glColor4ub(GLubyte(96 + hash % 160), GLubyte(96 + hash / 160 % 160), GLubyte(96 + hash / 25600 % 160), 220);
+         glRectf(left, y + 3, left + (std::min)(GLfloat(ms) * scale, 320.0f), y + rowHeight - 3);
+         if (m_font)
+         {
+            std::ostringstream label;
+            label << std::fixed << std::setprecision(2) << name << " " << ms;
+            const auto text = label.str();
+            glColor3f(1, 1, 1);
+            glRasterPos2f(10, y + 4);
+            glListBase(m_font - 32);
+            glCallLists(GLsizei(text.size()), GL_UNSIGNED_BYTE, text.data());
+         }
+      }
+      glColor3f(1, 0.3f, 0.3f);
+      glBegin(GL_LINES);
+      glVertex2f(left + 300, top + 4);
+      glVertex2f(left + 300, top - rowHeight * averages.size() - 4);
+      glEnd();
+
+      glPopMatrix();
+      glMatrixMode(GL_PROJECTION);
+      glPopMatrix();
+      glMatrixMode(GL_MODELVIEW);
+      glPopAttrib();
+   }
+
+   struct WndClass : public WNDCLASS
+   {
+      WndClass() : WNDCLASS()
+      {
+         lpszClassName = typeid(*this).name();
+         hInstance = GetModuleHandle(nullptr);
+
+         style = CS_DBLCLKS | CS_HREDRAW;
+         lpfnWndProc = WndProcInit_;
+         cbClsExtra = 0;
+         cbWndExtra = 0;
+         hIcon = LoadIcon (hInstance, lpszClassName);
+         hCursor = LoadCursor(nullptr, IDC_ARROW);
+         hbrBackground = HBRUSH(COLOR_WINDOW + 1);
+         lpszMenuName = lpszClassName;
+         RegisterClass(this);
+      }
+      ~WndClass()
+      {
+         UnregisterClass(lpszClassName, hInstance);
+      }
+   };
+
+private:
+
+   static LRESULT WINAPI WndProcInit_(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+   {
+      if (uMsg == WM_CREATE)
+      {
+         const CREATESTRUCT* createStruct = LPCREATESTRUCT(lParam);
+         SetWindowLongPtrA(hWnd, GWLP_USERDATA, LONG_PTR(createStruct->lpCreateParams));
+         SetWindowLongPtrA(hWnd, GWLP_WNDPROC, LONG_PTR(WndProc_));
+         GLTestWindow* wnd = reinterpret_cast<GLTestWindow*>(createStruct->lpCreateParams);
+         wnd->m_hwnd = hWnd;
+         return WndProc_(hWnd, uMsg, wParam, lParam);
+      }
+      return DefWindowProc(hWnd, uMsg, wParam, lParam);
+   }
+
+   static LRESULT WINAPI WndProc_(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+   {
+      if (uMsg != WM_NCHITTEST)
+      {
+         logger.Write<LogLevel::Trace>(LogCategory::Window, "message", uMsg, wParam, lParam);
+      }
+      GLTestWindow* const wnd = reinterpret_cast<GLTestWindow*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
+      const auto res = wnd->WindowProc(hWnd, uMsg, wParam, lParam);
+
+      if (uMsg == WM_DESTROY)
+      {
+         wnd->m_hwnd = nullptr;
+         SetWindowLongPtr(hWnd, GWLP_WNDPROC, LONG_PTR(DefWindowProc));
+      }
+      return res;
+   }
+
+   LRESULT WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+   {
+      const bool input = uMsg == WM_LBUTTONDOWN || uMsg == WM_MOUSEMOVE || uMsg == WM_MOUSEWHEEL
+         || uMsg == WM_LBUTTONDBLCLK || uMsg == WM_KEYDOWN;
+      if (input && m_inputHandler)
+         m_inputHandler(uMsg, wParam, lParam);
+
+      switch (uMsg)
+      {
+      case WM_CLOSE:
+         DestroyWindow(hwnd);
+         break;
+
+      case WM_DESTROY:
+         FinishCapture();
+         m_capture.reset();
+         if (m_hrc)
+         {
+            m_textures.Close();
+            glResources.Forget(m_hrc);
+            wglDeleteContext(m_hrc);
+         }
+
+         if (m_hdc)
+            ReleaseDC(hwnd, m_hdc);
+
+         break;
+
+      // The context may be current on the render thread; Draw applies the new size.
+      case WM_SIZE:
+         if (!m_framebuffer)
+         {
+            RECT rect{};
+            GetClientRect(hwnd, &rect);
+            m_width = rect.right;
+            m_height = rect.bottom;
+            m_resized = true;
+            m_damaged = true;
+         }
+         break;
+
+      case WM_PAINT:
+         ValidateRect(hwnd, nullptr);
+         m_damaged = true;
+         break;
+
+      case WM_LBUTTONDOWN:
+      case WM_MOUSEMOVE:
+         {
+            const int dragX = short(LOWORD(lParam));
+            const int dragY = short(HIWORD(lParam));
+            if (wParam & MK_LBUTTON)
+            {
+               moveCamera([&] {
+                  m_longinc = 0;
+                  m_longitude = std::fmod(m_longitude + double(dragX - m_dragX) / 5, 360);
+                  m_latitude = (std::min)(80.0, (std::max)(-80.0, m_latitude + double(dragY - m_dragY) / 5));
+               });
+            }
+            m_dragX = dragX;
+            m_dragY = dragY;
+         }
+         break;
+
+      case WM_MOUSEWHEEL:
+         moveCamera([&] {
+            m_viewDistance = (std::min)(20.0, (std::max)(3.0, m_viewDistance - GET_WHEEL_DELTA_WPARAM(wParam) / double(WHEEL_DELTA)));
+         });
+         break;
+
+      case WM_LBUTTONDBLCLK:
+         {
+            WINDOWPLACEMENT wp {};
+            GetWindowPlacement(hwnd, &wp);
+            ShowWindow(hwnd, wp.showCmd == SW_MAXIMIZE ? SW_SHOWNORMAL : SW_SHOWMAXIMIZED);
+         }
+         break;
+
+      case WM_KEYDOWN:
+         m_damaged = true;
+         switch (wParam)
+         {
+         case 'P':
+            moveCamera([this] { ShowProfile(!m_profileOverlay); });
+            break;
+         case VK_ESCAPE:
+            DestroyWindow(hwnd);
+            break;
+         case VK_LEFT:
+            moveCamera([this] { m_longinc -= 10.0; });
+            break;
+         case VK_RIGHT:
+            moveCamera([this] { m_longinc += 10.0; });
+            break;
+         case VK_UP:
+            moveCamera([this] { m_latitude = (std::min)(80.0, (std::max)(-80.0, m_latitude - 1)); });
+            break;
+         case VK_DOWN:
+            moveCamera([this] { m_latitude = (std::min)(80.0, (std::max)(-80.0, m_latitude + 1)); });
+            break;
+         default:
+            if (m_keyHandler)
+               m_keyHandler(wParam);
+            break;
+         }
+         break;
+
+      default:
+         return DefWindowProc(hwnd, uMsg, wParam, lParam);
+      }
+      return true;
+   }
+
+private:
+   // The camera is moved here on the window thread while the render thread latches it. Every move
+   // is stamped when it is handled. GetMessageTime would include the wait in the queue, but it
+   // counts in system ticks of about 15.6 ms, as long as the latency being measured; main handles
+   // mouse messages while the windows draw instead, so they hardly wait.
+   template <typename Move>
+   void moveCamera(Move&& move)
+   {
+      const auto time = Clock::now();
+      std::lock_guard<std::mutex> lock(m_cameraMutex);
+      move();
+      m_inputTimes.push_back(time);
+      m_damaged = true;
+   }
+
+   // The camera latchCamera would return now, without taking it.
+   CameraState peekCamera(double dt) const
+   {
+      std::lock_guard<std::mutex> lock(m_cameraMutex);
+      return {std::fmod(m_longitude + m_longinc * dt, 360), m_latitude, m_viewDistance};
+   }
+
+   // Advances the spin and hands the camera and the input that moved it to the frame.
+   CameraState latchCamera(double dt)
+   {
+      std::lock_guard<std::mutex> lock(m_cameraMutex);
+      //m_latitude = fmod(m_latitude + m_latinc * dt, 360);
+      //m_latitude = 30;
+      m_longitude = fmod(m_longitude + m_longinc * dt, 360);
+      m_longinc *= std::exp(-dt / 2);
+      if (-5 < m_longinc && m_longinc < 5)
+         m_longinc = 0;
+      m_latchedInputs.insert(m_latchedInputs.end(), m_inputTimes.begin(), m_inputTimes.end());
+      m_inputTimes.clear();
+      return {m_longitude, m_latitude, m_viewDistance};
+   }
+
+   // How far the camera may move between culling and a late latch, in degrees and units: a drag
+   // of 15 pixels, about what a quick drag makes in a frame. The wheel moves in whole units, so a
+   // notch during the frame always has the objects culled again; leaving room for it would keep
+   // nearly everything in a close view.
+   static constexpr double latchSlackAngle = 3;
+   static constexpr double latchSlackDistance = 0;
+
+   static WndClass m_wndClass;
+   static std::map<std::pair<GLShareGroup, const IGLObject*>, std::weak_ptr<GLCompiledList>> m_compiledLists;
+   static std::mutex m_compiledMutex;
+   static bool m_shareResources;
+   HWND m_hwnd = nullptr;
+   HDC   m_hdc = nullptr;
+   HGLRC m_hrc = nullptr;
+   GLsizei m_width = 0;
+   GLsizei m_height = 0;
+   bool m_resized = false;
+   bool m_onDemand = false;
+   std::atomic<bool> m_damaged{true};
+   KeyHandler m_keyHandler;
+   InputHandler m_inputHandler;
+   GLuint m_framebuffer = 0;
+   GLuint m_renderbuffers[2]{};
+   std::unique_ptr<FrameCapture> m_capture;
+   Matrix4 m_projection{};
+   GLView m_view;
+   RenderQueue m_queue;
+   double m_viewDistance = 4;
+   double m_viewLevel = (floorLevel * 75 + topLevel * 0.25);
+   double m_latitude = 10.0;
+   double m_longitude = -20.0;
+   double m_latinc = 6.0;
+   double m_longinc = 2.5;
+   mutable std::mutex m_cameraMutex;
+   std::vector<Clock::time_point> m_inputTimes;
+   std::vector<Clock::time_point> m_latchedInputs;
+   bool m_lateLatch = false;
+   GLObjectMap m_glObjects;
+   TextureUploader m_textures;
+   size_t m_uploadBudget = size_t(4) << 20;
+   GpuTimer m_gpuTimer;
+   // Toggled by the message loop, read by the render thread.
+   std::atomic<bool> m_profileOverlay{false};
+   GLuint m_font = 0;
+   bool m_fontFailed = false;
+   FrameStats m_frameStats;
+   int m_dragX = 0;
+   int m_dragY = 0;
+};
+
+GLTestWindow::WndClass GLTestWindow::m_wndClass;
+std::map<std::pair<GLShareGroup, const IGLObject*>, std::weak_ptr<GLCompiledList>> GLTestWindow::m_compiledLists;
+std::mutex GLTestWindow::m_compiledMutex;
+bool GLTestWindow::m_shareResources = true;
+
+// One thread per window, each drawing its window with the window's context current on it. Draw
+// starts a frame on all of them and returns once every window has swapped, so the scene they read
+// holds still while they render, and input is handled on the calling thread in between.
+class RenderThreads
+{
+public:
+
+   explicit RenderThreads(std::vector<GLTestWindow*> windows)
+      : m_windows(std::move(windows)), m_doneEvent(CreateEvent(nullptr, FALSE, FALSE, nullptr))
+   {
+      // A context can only be current on one thread.
+      wglMakeCurrent(nullptr, nullptr);
+      for (size_t i = 0; i < m_windows.size(); ++i)
+         m_threads.emplace_back([this, i] { renderLoop(*m_windows[i], i); });
+   }
+
+   RenderThreads(const RenderThreads&) = delete;
+
+   ~RenderThreads()
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_stop = true;
+      }
+      m_wake.notify_all();
+      for (auto&& thread : m_threads)
+         thread.join();
+      CloseHandle(m_doneEvent);
+   }
+
+   // Returns the number of windows still open. Windows drawing on demand are skipped while they
+   // have nothing new to show. While they draw, whileWaiting is called for every batch of window
+   // messages that comes in.
+   size_t Draw(double dt, const std::function<void()>& whileWaiting = {})
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_dt = dt;
+      m_pending = m_windows.size();
+      m_drawn = 0;
+      ++m_generation;
+      m_wake.notify_all();
+      while (whileWaiting && m_pending)
+      {
+         lock.unlock();
+         if (MsgWaitForMultipleObjects(1, &m_doneEvent, FALSE, INFINITE, QS_ALLINPUT) != WAIT_OBJECT_0)
+            whileWaiting();
+         lock.lock();
+      }
+      m_done.wait(lock, [this] { return m_pending == 0; });
+      return m_drawn;
+   }
+
+private:
+
+   void renderLoop(GLTestWindow& wnd, size_t index)
+   {
+      profiler.NameThread("view " + std::to_string(index));
+      size_t generation = 0;
+      for (;;)
+      {
+         double dt = 0;
+         {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_generation != generation; });
+            if (m_stop)
+               return;
+            generation = m_generation;
+            dt = m_dt;
+         }
+
+         const bool open = bool(wnd);
+         if (open && wnd.NeedsRedraw())
+         {
+            wnd.Draw(dt);
+            // Released so the window thread can delete the context when the window closes.
+            wglMakeCurrent(nullptr, nullptr);
+         }
+
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_drawn += open;
+         if (--m_pending == 0)
+         {
+            m_done.notify_one();
+            SetEvent(m_doneEvent);
+         }
+      }
+   }
+
+private:
+   std::vector<GLTestWindow*> m_windows;
+   std::vector<std::thread> m_threads;
+   std::mutex m_mutex;
+   std::condition_variable m_wake;
+   std::condition_variable m_done;
+   size_t m_generation = 0;
+   size_t m_pending = 0;
+   size_t m_drawn = 0;
+   double m_dt = 0;
+   bool m_stop = false;
+   HANDLE m_doneEvent;
+};
+
+double rand() { return std::rand() / double(RAND_MAX);  }
+
+#if defined(__GNUC__)
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define AVX2_TARGET
+#endif
+
+bool hasAvx2()
+{
+#if defined(_MSC_VER)
+   int info[4]{};
+   __cpuid(info, 0);
+   if (info[0] < 7)
+      return false;
+
+   __cpuid(info, 1);
+   const bool osxsave = info[2] & (1 << 27);
+   const bool avx = info[2] & (1 << 28);
+   if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+      return false;
+
+   __cpuidex(info, 7, 0);
+   return info[1] & (1 << 5);
+#else
+   return __builtin_cpu_supports("avx2");
+#endif
+}
+
+class BallStore
+{
+public:
+
+   using Color = std::array<GLubyte, 4>;
+
+   size_t Add(double radius = 0.105)
+   {
+      const double x = rand() * 4 - 2;
+      const double z = rand() * 4 - 2;
+      const double vx = rand() * 2 - 1;
+      const double vy = rand() * 3 + 3;
+      const double vz = rand() * 2 - 1;
+      const double t = rand() * vy/5;
+      const Color color{GLubyte(rand() * 255), GLubyte(rand() * 255), GLubyte(rand() * 255), 255};
+
+      m_minRadius = m_x.empty() ? radius : (std::min)(m_minRadius, radius);
+      m_radius.push_back(radius);
+      m_x.push_back(x);
+      m_y.push_back(0);
+      m_z.push_back(z);
+      m_rotation.push_back(0);
+      m_vx.push_back(vx);
+      m_vy.push_back(vy);
+      m_vz.push_back(vz);
+      m_t.push_back(t);
+      m_color.push_back(color);
+      return m_x.size() - 1;
+   }
+
+   size_t size() const { return m_x.size(); }
+
+   double GetX(size_t i) const { return m_x[i]; }
+   double GetY(size_t i) const { return m_y[i]; }
+   double GetZ(size_t i) const { return m_z[i]; }
+   double GetRotation(size_t i) const { return m_rotation[i]; }
+   double GetRadius(size_t i) const { return m_radius[i]; }
+   double GetMinRadius() const { return m_minRadius; }
+   const Color& GetColor(size_t i) const { return m_color[i]; }
+   void SetColor(size_t i, const Color& color) { m_color[i] = color; }
+
+   bool Overlaps(size_t i, size_t j) const
+   {
+      const double dx = m_x[j] - m_x[i];
+      const double dy = m_y[j] - m_y[i];
+      const double dz = m_z[j] - m_z[i];
+      const double r = m_radius[i] + m_radius[j];
+      return dx * dx + dy * dy + dz * dz < r * r;
+   }
+
+   // Elastic collision with masses proportional to volume. The vertical motion is a fixed
+   // bounce, so only the velocities in the floor plane change.
+   bool Collide(size_t i, size_t j)
+   {
+      if (!Overlaps(i, j))
+         return false;
+
+      const double dx = m_x[j] - m_x[i];
+      const double dz = m_z[j] - m_z[i];
+      const double d = std::sqrt(dx * dx + dz * dz);
+      if (d == 0)
+         return false;
+
+      const double nx = dx / d;
+      const double nz = dz / d;
+      const double approach = (m_vx[j] - m_vx[i]) * nx + (m_vz[j] - m_vz[i]) * nz;
+      if (approach >= 0)
+         return false;
+
+      const double mi = m_radius[i] * m_radius[i] * m_radius[i];
+      const double mj = m_radius[j] * m_radius[j] * m_radius[j];
+      const double impulse = 2 * approach / (mi + mj);
+      m_vx[i] += impulse * mj * nx;
+      m_vz[i] += impulse * mj * nz;
+      m_vx[j] -= impulse * mi * nx;
+      m_vz[j] -= impulse * mi * nz;
+      return true;
+   }
+
+   void Step(double dt) { Step(dt, 0, size()); }
+
+   void Step(double dt, size_t begin, size_t end)
+   {
+      static const bool avx2 = hasAvx2();
+      if (avx2)
+         begin = stepAvx2(dt, begin, end);
+      stepScalar(dt, begin, end);
+   }
+
+   void StepScalar(double dt) { stepScalar(dt, 0, size()); }
+
+private:
+
+   void stepScalar(double dt, size_t begin, size_t end)
+   {
+      for (size_t i = begin; i < end; ++i)
+      {
+         m_t[i] = std::fmod(m_t[i] + dt, m_vy[i]/5);
+
+         m_y[i] = floorLevel + m_radius[i] + m_vy[i] * m_t[i] - 10 * m_t[i] * m_t[i] / 2;
+         m_rotation[i] = std::fmod(m_rotation[i] + 123 * dt, 360);
+
+         m_x[i] += m_vx[i] * dt;
+         if (m_x[i] < -3 + m_radius[i] && m_vx[i] < 0 || m_x[i] > 3 - m_radius[i] && m_vx[i] > 0)
+            m_vx[i] = -m_vx[i];
+
+         m_z[i] += m_vz[i] * dt;
+         if (m_z[i] < -3 + m_radius[i] && m_vz[i] < 0 || m_z[i] > 3 - m_radius[i] && m_vz[i] > 0)
+            m_vz[i] = -m_vz[i];
+      }
+   }
+
+   // Processes whole groups of four balls and returns the index of the first one left over.
+   AVX2_TARGET size_t stepAvx2(double dt, size_t begin, size_t end)
+   {
+      const __m256d vdt = _mm256_set1_pd(dt);
+      const __m256d five = _mm256_set1_pd(5);
+      const __m256d floor = _mm256_set1_pd(floorLevel);
+      const __m256d turn = _mm256_set1_pd(360);
+      const __m256d spin = _mm256_set1_pd(123 * dt);
+
+      for (; begin + 4 <= end; begin += 4)
+      {
+         const __m256d r = _mm256_loadu_pd(&m_radius[begin]);
+         const __m256d vy = _mm256_loadu_pd(&m_vy[begin]);
+         const __m256d t = fmod4(_mm256_add_pd(_mm256_loadu_pd(&m_t[begin]), vdt), _mm256_div_pd(vy, five));
+         _mm256_storeu_pd(&m_t[begin], t);
+         _mm256_storeu_pd(&m_y[begin], _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(floor, r), _mm256_mul_pd(vy, t)),
+            _mm256_mul_pd(five, _mm256_mul_pd(t, t))));
+         _mm256_storeu_pd(&m_rotation[begin], fmod4(_mm256_add_pd(_mm256_loadu_pd(&m_rotation[begin]), spin), turn));
+
+         const __m256d vx = _mm256_loadu_pd(&m_vx[begin]);
+         const __m256d x = _mm256_add_pd(_mm256_loadu_pd(&m_x[begin]), _mm256_mul_pd(vx, vdt));
+         _mm256_storeu_pd(&m_x[begin], x);
+         _mm256_storeu_pd(&m_vx[begin], reflect4(x, vx, r));
+
+         const __m256d vz = _mm256_loadu_pd(&m_vz[begin]);
+         const __m256d z = _mm256_add_pd(_mm256_loadu_pd(&m_z[begin]), _mm256_mul_pd(vz, vdt));
+         _mm256_storeu_pd(&m_z[begin], z);
+         _mm256_storeu_pd(&m_vz[begin], reflect4(z, vz, r));
+      }
+      return begin;
+   }
+
+   AVX2_TARGET static __m256d fmod4(__m256d a, __m256d b)
+   {
+      return _mm256_sub_pd(a, _mm256_mul_pd(b, _mm256_round_pd(_mm256_div_pd(a, b), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)));
+   }
+
+   AVX2_TARGET static __m256d reflect4(__m256d p, __m256d v, __m256d r)
+   {
+      const __m256d wall = _mm256_set1_pd(3);
+      const __m256d zero = _mm256_setzero_pd();
+      const __m256d low = _mm256_and_pd(_mm256_cmp_pd(p, _mm256_sub_pd(r, wall), _CMP_LT_OQ), _mm256_cmp_pd(v, zero, _CMP_LT_OQ));
+      const __m256d high = _mm256_and_pd(_mm256_cmp_pd(p, _mm256_sub_pd(wall, r), _CMP_GT_OQ), _mm256_cmp_pd(v, zero, _CMP_GT_OQ));
+      return _mm256_xor_pd(v, _mm256_and_pd(_mm256_or_pd(low, high), _mm256_set1_pd(-0.0)));
+   }
+
+private:
+   std::vector<double> m_radius;
+   std::vector<double> m_x;
+   std::vector<double> m_y;
+   std::vector<double> m_z;
+   std::vector<double> m_rotation;
+   std::vector<double> m_vx;
+   std::vector<double> m_vy;
+   std::vector<double> m_vz;
+   std::vector<double> m_t;
+   std::vector<Color> m_color;
+   double m_minRadius = 0;
+};
+
+// Uniform grid over the arena floor with cells as wide as the smallest ball, so that any two
+// touching balls of that size sit in the same or in adjacent cells. Balls are counting-sorted by
+// cell, which keeps building and walking the grid linear in the number of balls. Balls too big for
+// a cell, such as the globes among the small balls, are kept out of it: each is tested against the
+// other big ones and against every cell within its reach.
+class SpatialHashGrid
+{
+public:
+
+   template <typename F>
+   void ForEachCandidate(const BallStore& store, F&& f)
+   {
+      build(store);
+
+      const int offsets[][2]{{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+      for (int cz = 0; cz < m_cells; ++cz)
+      {
+         for (int cx = 0; cx < m_cells; ++cx)
+         {
+            const size_t cell = size_t(cz) * m_cells + cx;
+            const size_t begin = m_cellStart[cell];
+            const size_t end = m_cellStart[cell + 1];
+            for (size_t a = begin; a < end; ++a)
+            {
+               for (size_t b = a + 1; b < end; ++b)
+                  f(m_order[a], m_order[b]);
+            }
+
+            for (auto&& offset : offsets)
+            {
+               const int nx = cx + offset[0];
+               const int nz = cz + offset[1];
+               if (nx < 0 || nx >= m_cells || nz >= m_cells)
+                  continue;
+
+               const size_t neighbour = size_t(nz) * m_cells + nx;
+               for (size_t a = begin; a < end; ++a)
+               {
+                  for (size_t b = m_cellStart[neighbour]; b < m_cellStart[neighbour + 1]; ++b)
+                     f(m_order[a], m_order[b]);
+               }
+            }
+         }
+      }
+
+      for (size_t a = 0; a < m_large.size(); ++a)
+      {
+         const size_t i = m_large[a];
+         for (size_t b = a + 1; b < m_large.size(); ++b)
+            f(i, size_t(m_large[b]));
+
+         // A small ball touching this one is at most half a cell further out than its radius.
+         const double reach = store.GetRadius(i) + m_cellSize;
+         const int x0 = coordinate(store.GetX(i) - reach);
+         const int x1 = coordinate(store.GetX(i) + reach);
+         const int z0 = coordinate(store.GetZ(i) - reach);
+         const int z1 = coordinate(store.GetZ(i) + reach);
+         for (int cz = z0; cz <= z1; ++cz)
+         {
+            const size_t row = size_t(cz) * m_cells;
+            for (size_t b = m_cellStart[row + x0]; b < m_cellStart[row + x1 + 1]; ++b)
+               f(i, size_t(m_order[b]));
+         }
+      }
+   }
+
+private:
+
+   static constexpr double arena = 6;
+
+   int coordinate(double v) const { return (std::min)(m_cells - 1, (std::max)(0, int((v + arena / 2) / m_cellSize))); }
+
+   // Cells are capped at a few per ball, since every cell is walked each tick whether it holds a
+   // ball or not.
+   void build(const BallStore& store)
+   {
+      const size_t n = store.size();
+      const int maxCells = (std::min)(1024, int(std::sqrt(4.0 * n)) + 1);
+      const double diameter = 2 * store.GetMinRadius();
+      m_cells = diameter > 0 ? (std::max)(1, (std::min)(maxCells, int(arena / diameter))) : 1;
+      m_cellSize = arena / m_cells;
+
+      m_large.clear();
+      m_cellOf.resize(n);
+      m_cellStart.assign(size_t(m_cells) * m_cells + 1, 0);
+      for (size_t i = 0; i < n; ++i)
+      {
+         if (2 * store.GetRadius(i) > m_cellSize)
+         {
+            m_large.push_back(uint32_t(i));
+            m_cellOf[i] = uint32_t(-1);
+            continue;
+         }
+         m_cellOf[i] = uint32_t(size_t(coordinate(store.GetZ(i))) * m_cells + coordinate(store.GetX(i)));
+         ++m_cellStart[m_cellOf[i] + 1];
+      }
+      for (size_t c = 1; c < m_cellStart.size(); ++c)
+         m_cellStart[c] += m_cellStart[c - 1];
+
+      m_cursor.assign(m_cellStart.begin(), m_cellStart.end() - 1);
+      m_order.resize(n - m_large.size());
+      for (size_t i = 0; i < n; ++i)
+      {
+         if (m_cellOf[i] != uint32_t(-1))
+            m_order[m_cursor[m_cellOf[i]]++] = uint32_t(i);
+      }
+   }
+
+private:
+   int m_cells = 1;
+   double m_cellSize = arena;
+   std::vector<uint32_t> m_cellOf;
+   std::vector<uint32_t> m_cellStart;
+   std::vector<uint32_t> m_cursor;
+   std::vector<uint32_t> m_order;
+   std::vector<uint32_t> m_large;
+};
+
+class GLDisplayList : public IGLObject
+{
+public:
+
+   GLDisplayList() = default;
+   explicit GLDisplayList(const std::function<void()>& draw) : m_draw(draw) {}
+   explicit GLDisplayList(const std::shared_ptr<const PackedMesh>& mesh) { Reset(mesh); }
+
+   size_t GetVersion() const override { return m_version; }
+   void Draw() override { m_draw(); }
+   bool UsesList() const override { return !m_mesh || !glExt; }
+
+   // A mesh is drawn from its buffer objects when there are any, the list being the fallback.
+   // Its opaque batches are part 0, drawn without blending, and its translucent ones part 1.
+   void Submit(const GLView& view, std::vector<DrawItem>& items) const override
+   {
+      if (!m_mesh || !glExt)
+      {
+         IGLObject::Submit(view, items);
+         return;
+      }
+      DrawItem item;
+      BoundingSphere bounds;
+      if (GetBounds(bounds))
+         item.depth = view.GetDepth(bounds.center);
+      if (m_mesh->HasBatches(false))
+      {
+         item.state.blend = false;
+         items.push_back(item);
+      }
+      if (m_mesh->HasBatches(true))
+      {
+         item.part = 1;
+         item.state.blend = true;
+         item.state.depthWrite = false;
+         item.translucent = true;
+         items.push_back(item);
+      }
+   }
+
+   void Render(GLuint list, GLView& view, size_t part) const override
+   {
+      if (!m_mesh || !glExt)
+      {
+         IGLObject::Render(list, view, part);
+         return;
+      }
+      glPushMatrix();
+      Transform();
+      m_mesh->Render(part == 1);
+      glPopMatrix();
+      view.triangles += m_mesh->GetTriangles(part == 1);
+   }
+
+   void Reset(const std::function<void()>& draw)
+   {
+      m_draw = draw;
+      m_mesh = nullptr;
+      ++m_version;
+   }
+
+   void Reset(const std::shared_ptr<const PackedMesh>& mesh)
+   {
+      Reset([mesh] { mesh->Draw(); });
+      m_mesh = mesh;
+   }
+
+private:
+   size_t m_version = 0;
+   std::function<void()> m_draw = []{};
+   std::shared_ptr<const PackedMesh> m_mesh;
+};
+
+// The walls and a tiles x tiles floor as a single static mesh over a texture atlas. The walls
+// sample the atlas' white block, so the whole room is one draw call with one texture bind.
+class Floor : public IGLObject
+{
+public:
+
+   static constexpr int maxTiles = 1024;
+
+   Floor(const TextureAtlas& atlas, size_t inner, size_t border, int tiles = 8)
+      : m_texture(atlas.GetKey())
+   {
+      tiles = (std::min)(maxTiles, (std::max)(1, tiles));
+
+      const GLfloat walls[][3]{
+         {-3, floorLevel, -3}, {-3, topLevel, -3},
+         {-3, floorLevel, 3}, {-3, topLevel, 3},
+         {3, floorLevel, 3}, {3, topLevel, 3},
+         {3, floorLevel, -3}, {3, topLevel, -3},
+         {-3, floorLevel, -3}, {-3, topLevel, -3},
+      };
+      const GLubyte wallColors[][4]{
+         {51, 51, 51, 255}, {51, 178, 51, 255},
+         {51, 51, 178, 255}, {51, 178, 178, 255},
+         {178, 51, 178, 255}, {178, 178, 178, 255},
+         {51, 178, 178, 255}, {51, 51, 178, 255},
+         {51, 51, 51, 255}, {51, 178, 51, 255},
+      };
+      const auto& white = atlas.GetWhite();
+      for (size_t i = 0; i < std::size(walls); ++i)
+      {
+         Vertex vertex{{walls[i][0], walls[i][1], walls[i][2]}, {white.u0, white.v0}, {}};
+         std::copy_n(wallColors[i], 4, vertex.color);
+         m_vertices.push_back(vertex);
+      }
+      // Quad k of the strip is 2k, 2k+1, 2k+3, 2k+2, which keeps its original facing.
+      for (GLuint k = 0; k + 3 < GLuint(std::size(walls)); k += 2)
+         m_indices.insert(m_indices.end(), {k, k + 1, k + 3, k, k + 3, k + 2});
+
+      m_vertices.reserve(m_vertices.size() + size_t(tiles) * tiles * 4);
+      m_indices.reserve(m_indices.size() + size_t(tiles) * tiles * 6);
+      for (int i = 0; i < tiles; ++i)
+      {
+         const GLfloat z0 = GLfloat(-3 + 6.0 / tiles * i);
+         const GLfloat z1 = GLfloat(-3 + 6.0 / tiles * (i + 1));
+         for (int j = 0; j < tiles; ++j)
+         {
+            const GLfloat x0 = GLfloat(-3 + 6.0 / tiles * j);
+            const GLfloat x1 = GLfloat(-3 + 6.0 / tiles * (j + 1));
+            const bool edge = i == 0 || i == tiles - 1 || j == 0 || j == tiles - 1;
+            const auto& uv = atlas.GetRegion(edge ? border : inner);
+
+            const GLuint first = GLuint(m_vertices.size());
+            m_vertices.push_back({{x0, floorLevel, z0}, {uv.u0, uv.v0}, {255, 255, 255, 255}});
+            m_vertices.push_back({{x0, floorLevel, z1}, {uv.u0, uv.v1}, {255, 255, 255, 255}});
+            m_vertices.push_back({{x1, floorLevel, z1}, {uv.u1, uv.v1}, {255, 255, 255, 255}});
+            m_vertices.push_back({{x1, floorLevel, z0}, {uv.u1, uv.v0}, {255, 255, 255, 255}});
+            m_indices.insert(m_indices.end(), {first, first + 1, first + 2, first, first + 2, first + 3});
+         }
+      }
+   }
+
+   ~Floor()
+   {
+      for (auto&& [group, buffers] : m_buffers)
+      {
+         glResources.Release(GLResourceType::Buffer, buffers.vertices, group);
+         glResources.Release(GLResourceType::Buffer, buffers.indices, group);
+      }
+   }
+
+   size_t GetVersion() const override { return 0; }
+
+   // Only used when buffer objects are unavailable; the list then captures the client arrays.
+   void Draw() override
+   {
+      glBindTexture(GL_TEXTURE_2D, glResources.Lookup(m_texture));
+      enableArrays(reinterpret_cast<const char*>(m_vertices.data()));
+      glDrawElements(GL_TRIANGLES, GLsizei(m_indices.size()), GL_UNSIGNED_INT, m_indices.data());
+      disableArrays();
+      glBindTexture(GL_TEXTURE_2D, 0);
+   }
+
+   bool UsesList() const override { return !glExt; }
+
+   bool GetBounds(BoundingSphere& bounds) const override
+   {
+      const GLfloat height = GLfloat(topLevel - floorLevel);
+      bounds = {{0, GLfloat(floorLevel) + height / 2, 0}, std::sqrt(18 + height * height / 4)};
+      return true;
+   }
+
+   // Opaque. The display list binds the texture itself.
+   void Submit(const GLView& view, std::vector<DrawItem>& items) const override
+   {
+      DrawItem item;
+      item.state.blend = false;
+      item.state.texture = glExt ? glResources.Lookup(m_texture) : 0;
+      BoundingSphere bounds;
+      GetBounds(bounds);
+      item.depth = view.GetDepth(bounds.center);
+      items.push_back(item);
+   }
+
+   void Render(GLuint list, GLView& view, size_t) const override
+   {
+      view.triangles += GetTriangleCount();
+      if (!glExt)
+      {
+         glCallList(list);
+         return;
+      }
+
+      const auto& buffers = getBuffers();
+      glExt.BindBuffer(GL_ARRAY_BUFFER, buffers.vertices);
+      glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indices);
+      enableArrays(nullptr);
+      glDrawElements(GL_TRIANGLES, GLsizei(m_indices.size()), GL_UNSIGNED_INT, nullptr);
+      disableArrays();
+      glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      glExt.BindBuffer(GL_ARRAY_BUFFER, 0);
+   }
+
+   size_t GetTriangleCount() const { return m_indices.size() / 3; }
+
+private:
+
+   struct Vertex
+   {
+      GLfloat position[3];
+      GLfloat texCoord[2];
+      GLubyte color[4];
+   };
+
+   struct Buffers
+   {
+      GLuint vertices = 0;
+      GLuint indices = 0;
+   };
+
+   static void enableArrays(const char* base)
+   {
+      glEnableClientState(GL_VERTEX_ARRAY);
+      glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+      glEnableClientState(GL_COLOR_ARRAY);
+      glVertexPointer(3, GL_FLOAT, sizeof(Vertex), base + offsetof(Vertex, position));
+      glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), base + offsetof(Vertex, texCoord));
+      glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), base + offsetof(Vertex, color));
+   }
+
+   static void disableArrays()
+   {
+      glDisableClientState(GL_COLOR_ARRAY);
+      glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+      glDisableClientState(GL_VERTEX_ARRAY);
+   }
+
+   // Windows of a share group may get here together from their render threads. The data must
+   // be complete before another context of the group draws from it, hence the glFinish.
+   const Buffers& getBuffers() const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto& buffers = m_buffers[glResources.GetGroup()];
+      if (!buffers.vertices)
+      {
+         buffers.vertices = glResources.Allocate(GLResourceType::Buffer);
+         buffers.indices = glResources.Allocate(GLResourceType::Buffer);
+
+         glExt.BindBuffer(GL_ARRAY_BUFFER, buffers.vertices);
+         glExt.BufferData(GL_ARRAY_BUFFER, GLsizeiptr(m_vertices.size() * sizeof(Vertex)), m_vertices.data(), GL_STATIC_DRAW);
+         glResources.SetBytes(GLResourceType::Buffer, buffers.vertices, m_vertices.size() * sizeof(Vertex));
+         glExt.BindBuffer(GL_ARRAY_BUFFER, 0);
+         glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indices);
+         glExt.BufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(m_indices.size() * sizeof(GLuint)), m_indices.data(), GL_STATIC_DRAW);
+         glResources.SetBytes(GLResourceType::Buffer, buffers.indices, m_indices.size() * sizeof(GLuint));
+         glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+         glFinish();
+      }
+      return buffers;
+   }
+
+private:
+   std::string m_texture;
+   std::vector<Vertex> m_vertices;
+   std::vector<GLuint> m_indices;
+   mutable std::map<GLShareGroup, Buffers> m_buffers;
+   mutable std::mutex m_mutex;
+};
+
+class WorkerPool
+{
+public:
+
+   using Task = std::function<void(size_t, size_t)>;
+
+   explicit WorkerPool(size_t threads = std::thread::hardware_concurrency())
+   {
+      threads = (std::max)(threads, size_t(1));
+      for (size_t i = 0; i < threads; ++i)
+         m_queues.push_back(std::make_unique<Queue>());
+      for (size_t i = 1; i < threads; ++i)
+         m_threads.emplace_back([this, i] { workerLoop(i); });
+   }
+
+   WorkerPool(const WorkerPool&) = delete;
+
+   ~WorkerPool()
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_stop = true;
+      }
+      m_wake.notify_all();
+      for (auto&& thread : m_threads)
+         thread.join();
+   }
+
+   size_t size() const { return m_queues.size(); }
+
+   // Splits [0, count) into chunks of the given size, deals them out to the per-thread queues
+   // and returns once all of them have run. Idle threads steal from the back of other queues.
+   void ParallelFor(size_t count, size_t chunk, const Task& task)
+   {
+      const size_t chunks = (count + chunk - 1) / chunk;
+      if (!chunks)
+         return;
+
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_pending += chunks;
+         for (size_t i = 0; i < chunks; ++i)
+         {
+            auto& queue = *m_queues[i % m_queues.size()];
+            std::lock_guard<std::mutex> queueLock(queue.mutex);
+            queue.items.push_back({i * chunk, (std::min)(count, (i + 1) * chunk), &task});
+         }
+         ++m_generation;
+      }
+      m_wake.notify_all();
+
+      while (runOne(0))
+         ;
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_done.wait(lock, [this] { return m_pending == 0; });
+   }
+
+private:
+
+   struct Item
+   {
+      size_t begin;
+      size_t end;
+      const Task* task;
+   };
+
+   struct Queue
+   {
+      std::mutex mutex;
+      std::deque<Item> items;
+   };
+
+   bool runOne(size_t self)
+   {
+      Item item{};
+      bool found = false;
+      for (size_t i = 0; i < m_queues.size() && !found; ++i)
+      {
+         auto& queue = *m_queues[(self + i) % m_queues.size()];
+         std::lock_guard<std::mutex> lock(queue.mutex);
+         if (!queue.items.empty())
+         {
+            found = true;
+            if (i == 0)
+            {
+               item = queue.items.front();
+               queue.items.pop_front();
+            }
+            else
+            {
+               item = queue.items.back();
+               queue.items.pop_back();
+            }
+         }
+      }
+      if (!found)
+         return false;
+
+      (*item.task)(item.begin, item.end);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (--m_pending == 0)
+         m_done.notify_all();
+      return true;
+   }
+
+   void workerLoop(size_t self)
+   {
+      profiler.NameThread("worker " + std::to_string(self));
+      size_t generation = 0;
+      for (;;)
+      {
+         {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_generation != generation; });
+            if (m_stop)
+               return;
+            generation = m_generation;
+         }
+         while (runOne(self))
+            ;
+      }
+   }
+
+private:
+   std::vector<std::unique_ptr<Queue>> m_queues;
+   std::vector<std::thread> m_threads;
+   std::mutex m_mutex;
+   std::condition_variable m_wake;
+   std::condition_variable m_done;
+   size_t m_pending = 0;
+   size_t m_generation = 0;
+   bool m_stop = false;
+};
+
+// Single producer, single consumer. Neither side ever waits: the producer always has a buffer
+// to write and the consumer keeps reading its current one until a fresher one is published.
+template <typename T>
+class TripleBuffer
+{
+public:
+
+   T& GetBack() { return m_buffers[m_back]; }
+
+   void Publish()
+   {
+      m_back = m_ready.exchange(m_back | fresh, std::memory_order_acq_rel) & index;
+   }
+
+   bool Acquire()
+   {
+      if (!(m_ready.load(std::memory_order_relaxed) & fresh))
+         return false;
+      m_front = m_ready.exchange(m_front, std::memory_order_acq_rel) & index;
+      return true;
+   }
+
+   const T& GetFront() const { return m_buffers[m_front]; }
+
+private:
+   static constexpr unsigned index = 3;
+   static constexpr unsigned fresh = 4;
+
+   std::array<T, 3> m_buffers;
+   unsigned m_back = 0;
+   std::atomic<unsigned> m_ready{1};
+   unsigned m_front = 2;
+};
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+class WaitableTimer
+{
+public:
+
+   WaitableTimer()
+      : m_handle(CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS))
+   {
+      // High resolution timers need Windows 10 1803, older systems get the regular one
+      if (!m_handle)
+         m_handle = CreateWaitableTimer(nullptr, TRUE, nullptr);
+   }
+
+   WaitableTimer(const WaitableTimer&) = delete;
+
+   ~WaitableTimer() { CloseHandle(m_handle); }
+
+   HANDLE GetHandle() const { return m_handle; }
+
+   void SetDue(Clock::time_point due)
+   {
+      using Ticks = std::chrono::duration<LONGLONG, std::ratio<1, 10000000>>;
+      LARGE_INTEGER relative{};
+      relative.QuadPart = -(std::max)(LONGLONG(0), std::chrono::duration_cast<Ticks>(due - Clock::now()).count());
+      SetWaitableTimer(m_handle, &relative, 0, nullptr, nullptr, FALSE);
+   }
+
+   void WaitUntil(Clock::time_point due)
+   {
+      SetDue(due);
+      WaitForSingleObject(m_handle, INFINITE);
+   }
+
+private:
+   HANDLE m_handle = nullptr;
+};
+
+class FramePacer
+{
+public:
+
+   // Zero fps leaves pacing to SwapBuffers, i.e. to vsync.
+   explicit FramePacer(double fps)
+      : m_period(fps > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / fps)) : Clock::duration::zero())
+   {
+   }
+
+   // Sleeps until either the next frame is due or a window message arrives and tells which one it was.
+   bool Wait()
+   {
+      if (m_period == Clock::duration::zero())
+         return true;
+
+      if (Clock::now() < m_next)
+      {
+         const HANDLE handle = m_timer.GetHandle();
+         m_timer.SetDue(m_next);
+         MsgWaitForMultipleObjects(1, &handle, FALSE, INFINITE, QS_ALLINPUT);
+      }
+
+      const auto now = Clock::now();
+      if (now < m_next)
+         return false;
+
+      m_next += m_period;
+      if (m_next < now)
+         m_next = now + m_period;
+      return true;
+   }
+
+private:
+   Clock::duration m_period;
+   Clock::time_point m_next = Clock::now();
+   WaitableTimer m_timer;
+};
+
+class FrameTimeHistogram
+{
+public:
+
+   void Add(double seconds)
+   {
+      ++m_buckets[(std::min)(size_t(seconds / bucketWidth), m_buckets.size() - 1)];
+      ++m_count;
+   }
+
+   // Upper bound of the bucket holding the given fraction of samples.
+   double GetPercentile(double fraction) const
+   {
+      const size_t target = size_t(std::ceil(fraction * m_count));
+      size_t count = 0;
+      for (size_t i = 0; i < m_buckets.size(); ++i)
+      {
+         count += m_buckets[i];
+         if (count >= target && count)
+            return (i + 1) * bucketWidth;
+      }
+      return 0;
+   }
+
+   size_t GetCount() const { return m_count; }
+
+   void Reset() { *this = {}; }
+
+private:
+   static constexpr double bucketWidth = 0.0001;
+
+   std::array<size_t, 1000> m_buckets{};
+   size_t m_count = 0;
+};
+
+double processCpuSeconds()
+{
+   FILETIME creation{}, exit{}, kernel{}, user{};
+   GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+   const auto seconds = [](const FILETIME& time) {
+      return double(ULONGLONG(time.dwHighDateTime) << 32 | time.dwLowDateTime) / 10000000;
+   };
+   return seconds(kernel) + seconds(user);
+}
+
+// Binary log of a run: the ball colours, then every simulation tick with the transforms
+// delta-encoded against the tick before, every frame with the tick it showed and the camera of
+// each window, and the input the windows received. Positions are kept in 1/4096 units and
+// rotations in 1/64 degrees, each delta as a zigzag varint, so a tick takes a few bytes a ball.
+namespace ReplayLog
+{
+
+using Transform = std::array<GLfloat, 4>;
+using Quantized = std::array<int32_t, 4>;
+
+enum class Record : char { Tick = 'T', Frame = 'F', Input = 'I' };
+
+constexpr char magic[4]{'G', 'L', 'R', 'P'};
+constexpr uint32_t version = 1;
+constexpr double positionScale = 4096;
+constexpr double rotationScale = 64;
+constexpr int32_t fullTurn = 360 * 64;
+
+inline Quantized quantize(const Transform& transform)
+{
+   Quantized quantized;
+   for (int k = 0; k < 3; ++k)
+      quantized[k] = int32_t(std::lround(transform[k] * positionScale));
+   quantized[3] = int32_t(std::lround(transform[3] * rotationScale)) % fullTurn;
+   return quantized;
+}
+
+inline Transform dequantize(const Quantized& quantized)
+{
+   return {GLfloat(quantized[0] / positionScale), GLfloat(quantized[1] / positionScale),
+      GLfloat(quantized[2] / positionScale), GLfloat(quantized[3] / rotationScale)};
+}
+
+inline void writeVarint(std::string& out, uint64_t value)
+{
+   for (; value >= 0x80; value >>= 7)
+      out.push_back(char(value | 0x80));
+   out.push_back(char(value));
+}
+
+inline void writeSigned(std::string& out, int64_t value)
+{
+   writeVarint(out, uint64_t(value) << 1 ^ uint64_t(value >> 63));
+}
+
+template <typename T>
+void writeRaw(std::string& out, const T& value)
+{
+   out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+class Recorder
+{
+public:
+
+   Recorder(const std::string& path, const BallStore& store)
+      : m_output(path, std::ios::binary), m_last(store.size())
+   {
+      std::string header(magic, sizeof(magic));
+      writeRaw(header, version);
+      writeRaw(header, uint32_t(store.size()));
+      for (size_t i = 0; i < store.size(); ++i)
+         header.append(reinterpret_cast<const char*>(store.GetColor(i).data()), 4);
+      append(header);
+   }
+
+   Recorder(const Recorder&) = delete;
+
+   explicit operator bool() const { return bool(m_output); }
+
+   // On the simulation thread, once per tick.
+   void WriteTick(size_t tick, double dt, const std::vector<Transform>& transforms)
+   {
+      m_tick.clear();
+      m_tick.push_back(char(Record::Tick));
+      writeVarint(m_tick, tick);
+      writeRaw(m_tick, GLfloat(dt));
+      for (size_t i = 0; i < m_last.size(); ++i)
+      {
+         const auto quantized = quantize(transforms[i]);
+         for (int k = 0; k < 3; ++k)
+            writeSigned(m_tick, int64_t(quantized[k]) - m_last[i][k]);
+         // The shorter way round, so that wrapping past 360 degrees stays a small step.
+         int32_t turn = (quantized[3] - m_last[i][3]) % fullTurn;
+         turn += turn > fullTurn / 2 ? -fullTurn : turn < -fullTurn / 2 ? fullTurn : 0;
+         writeSigned(m_tick, turn);
+         m_last[i] = quantized;
+      }
+      ++m_ticks;
+      append(m_tick);
+   }
+
+   // After the frame showing the given tick has been drawn.
+   void WriteFrame(size_t tick, double alpha, const std::vector<CameraState>& cameras)
+   {
+      std::string record(1, char(Record::Frame));
+      writeVarint(record, tick);
+      writeRaw(record, GLfloat(alpha));
+      writeVarint(record, cameras.size());
+      for (auto&& camera : cameras)
+      {
+         writeRaw(record, GLfloat(camera.longitude));
+         writeRaw(record, GLfloat(camera.latitude));
+         writeRaw(record, GLfloat(camera.distance));
+      }
+      append(record);
+   }
+
+   void WriteInput(size_t window, UINT message, WPARAM wParam, LPARAM lParam)
+   {
+      std::string record(1, char(Record::Input));
+      writeVarint(record, window);
+      writeVarint(record, message);
+      writeVarint(record, wParam);
+      writeSigned(record, lParam);
+      append(record);
+   }
+
+   size_t GetBytes() const { return m_bytes; }
+   size_t GetTicks() const { return m_ticks; }
+
+private:
+
+   void append(const std::string& record)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_output.write(record.data(), record.size());
+      m_bytes += record.size();
+   }
+
+private:
+   std::ofstream m_output;
+   std::mutex m_mutex;
+   std::vector<Quantized> m_last;
+   std::string m_tick;
+   std::atomic<size_t> m_bytes{0};
+   std::atomic<size_t> m_ticks{0};
+};
+
+// Reads a log through a mapping, a frame at a time. A truncated log ends at its last whole record.
+class Reader
+{
+public:
+
+   struct InputEvent
+   {
+      size_t window = 0;
+      UINT message = 0;
+      WPARAM wParam = 0;
+      LPARAM lParam = 0;
+   };
+
+   struct Frame
+   {
+      size_t tick = 0;
+      double dt = 0;
+      double alpha = 1;
+      const std::vector<Transform>* previous = nullptr;
+      const std::vector<Transform>* transforms = nullptr;
+      std::vector<CameraState> cameras;
+      std::vector<InputEvent> inputs;
+   };
+
+   explicit Reader(const std::string& path)
+      : m_file(path), m_position(m_file.data()), m_end(m_file.data() + m_file.size())
+   {
+      uint32_t fileVersion = 0;
+      uint32_t count = 0;
+      if (m_file.size() < sizeof(magic) || std::memcmp(m_file.data(), magic, sizeof(magic)) != 0)
+         return;
+      m_position += sizeof(magic);
+      if (!readRaw(fileVersion) || fileVersion != version || !readRaw(count) || size_t(m_end - m_position) / 4 < count)
+         return;
+      m_colors.resize(count);
+      for (auto&& color : m_colors)
+         readRaw(color);
+      m_last.resize(count);
+      m_valid = true;
+   }
+
+   explicit operator bool() const { return m_valid; }
+
+   const std::vector<BallStore::Color>& GetColors() const { return m_colors; }
+
+   // Decodes up to the next frame. The transforms stay valid until the following call.
+   bool Next(Frame& frame)
+   {
+      frame.inputs.clear();
+      while (m_valid && m_position < m_end)
+      {
+         const char* const start = m_position;
+         const auto type = Record(*m_position++);
+         bool read = false;
+         if (type == Record::Tick)
+            read = readTick();
+         else if (type == Record::Input)
+            read = readInput(frame);
+         else if (type == Record::Frame)
+            read = readFrame(frame);
+         if (!read)
+         {
+            m_position = start;
+            break;
+         }
+         if (type == Record::Frame)
+            return true;
+      }
+      return false;
+   }
+
+private:
+
+   template <typename T>
+   bool readRaw(T& value)
+   {
+      if (size_t(m_end - m_position) < sizeof(T))
+         return false;
+      std::memcpy(&value, m_position, sizeof(T));
+      m_position += sizeof(T);
+      return true;
+   }
+
+   bool readVarint(uint64_t& value)
+   {
+      value = 0;
+      for (int shift = 0; m_position < m_end && shift < 64; shift += 7)
+      {
+         const auto part = uint8_t(*m_position++);
+         value |= uint64_t(part & 0x7F) << shift;
+         if (!(part & 0x80))
+            return true;
+      }
+      return false;
+   }
+
+   bool readSigned(int64_t& value)
+   {
+      uint64_t zigzag = 0;
+      if (!readVarint(zigzag))
+         return false;
+      value = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+      return true;
+   }
+
+   bool readTick()
+   {
+      uint64_t tick = 0;
+      GLfloat dt = 0;
+      if (!readVarint(tick) || !readRaw(dt))
+         return false;
+      auto& transforms = m_ticks[tick];
+      transforms.resize(m_last.size());
+      for (size_t i = 0; i < m_last.size(); ++i)
+      {
+         for (int k = 0; k < 4; ++k)
+         {
+            int64_t delta = 0;
+            if (!readSigned(delta))
+            {
+               m_ticks.erase(tick);
+               return false;
+            }
+            m_last[i][k] += int32_t(delta);
+         }
+         m_last[i][3] = (m_last[i][3] % fullTurn + fullTurn) % fullTurn;
+         transforms[i] = dequantize(m_last[i]);
+      }
+      m_dt[tick] = dt;
+      return true;
+   }
+
+   bool readInput(Frame& frame)
+   {
+      uint64_t window = 0, message = 0, wParam = 0;
+      int64_t lParam = 0;
+      if (!readVarint(window) || !readVarint(message) || !readVarint(wParam) || !readSigned(lParam))
+         return false;
+      frame.inputs.push_back({size_t(window), UINT(message), WPARAM(wParam), LPARAM(lParam)});
+      return true;
+   }
+
+   bool readFrame(Frame& frame)
+   {
+      uint64_t tick = 0, count = 0;
+      GLfloat alpha = 1;
+      if (!readVarint(tick) || !readRaw(alpha) || !readVarint(count) || size_t(m_end - m_position) / 12 < count)
+         return false;
+      frame.cameras.resize(size_t(count));
+      for (auto&& camera : frame.cameras)
+      {
+         GLfloat values[3]{};
+         readRaw(values);
+         camera = {values[0], values[1], values[2]};
+      }
+
+      // The simulation runs ahead of the frames, so later ticks may already have been read.
+      // Ticks before the one preceding this frame's are not needed again.
+      m_ticks.erase(m_ticks.begin(), m_ticks.lower_bound(tick ? tick - 1 : 0));
+      m_dt.erase(m_dt.begin(), m_dt.lower_bound(tick ? tick - 1 : 0));
+      const auto found = m_ticks.find(tick);
+      if (found == m_ticks.end())
+         return false;
+      const auto before = m_ticks.find(tick - 1);
+      frame.tick = size_t(tick);
+      frame.dt = m_dt[tick];
+      frame.alpha = alpha;
+      frame.transforms = &found->second;
+      frame.previous = before != m_ticks.end() ? &before->second : &found->second;
+      return true;
+   }
+
+private:
+   MappedFile m_file;
+   const char* m_position = nullptr;
+   const char* m_end = nullptr;
+   bool m_valid = false;
+   std::vector<BallStore::Color> m_colors;
+   std::vector<Quantized> m_last;
+   std::map<uint64_t, std::vector<Transform>> m_ticks;
+   std::map<uint64_t, double> m_dt;
+};
+
+} // namespace ReplayLog
+
+class BallSimulation
+{
+public:
+
+   using Transform = std::array<GLfloat, 4>;
+
+   // Holds the state at the end of a tick and the one it started from, so that frames falling
+   // between two ticks can be interpolated.
+   struct Snapshot
+   {
+      size_t tick = 0;
+      double time = 0;
+      double dt = 0;
+      std::vector<Transform> previous;
+      std::vector<Transform> transforms;
+      std::vector<size_t> chunkTicks;
+      // Whether any ball is somewhere else than at the start of the tick.
+      bool moved = false;
+   };
+
+   static constexpr size_t chunkSize = 16384;
+
+   explicit BallSimulation(size_t threads = std::thread::hardware_concurrency(), double step = 1.0 / 120)
+      : m_pool(threads), m_step(step), m_published(CreateEvent(nullptr, FALSE, FALSE, nullptr))
+   {
+   }
+
+   BallSimulation(const BallSimulation&) = delete;
+
+   ~BallSimulation()
+   {
+      Stop();
+      CloseHandle(m_published);
+   }
+
+   // Balls may only be added while the simulation thread is stopped.
+   BallStore& GetStore() { return m_store; }
+   const BallStore& GetStore() const { return m_store; }
+
+   // Without balls there is nothing to tick, and windows drawing on demand can go idle.
+   void Start()
+   {
+      if (m_thread.joinable() || !m_store.size())
+         return;
+
+      Tick(0);
+      Acquire();
+
+      m_running = true;
+      m_epoch = Clock::now() - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_time));
+      m_thread = std::thread([this] {
+         profiler.NameThread("simulation");
+         const auto step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_step));
+         const size_t maxCatchUp = 5;
+         WaitableTimer timer;
+         auto next = Clock::now() + step;
+         while (m_running)
+         {
+            timer.WaitUntil(next);
+            for (size_t i = 0; i < maxCatchUp && next <= Clock::now(); ++i)
+            {
+               Tick(m_step);
+               next += step;
+            }
+            // Too far behind to catch up, drop the backlog instead of spiralling
+            if (next <= Clock::now())
+            {
+               next = Clock::now() + step;
+               m_epoch = Clock::now() - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_time));
+            }
+         }
+      });
+   }
+
+   void Stop()
+   {
+      m_running = false;
+      if (m_thread.joinable())
+         m_thread.join();
+   }
+
+   void Tick(double dt)
+   {
+      PROFILE_SCOPE("Tick");
+      auto& snapshot = m_snapshots.GetBack();
+      const size_t tick = ++m_tick;
+      snapshot.previous.resize(m_store.size());
+      snapshot.transforms.resize(m_store.size());
+      snapshot.chunkTicks.resize((m_store.size() + chunkSize - 1) / chunkSize);
+
+      const auto transform = [this](size_t i) {
+         return Transform{GLfloat(m_store.GetX(i)), GLfloat(m_store.GetY(i)), GLfloat(m_store.GetZ(i)), GLfloat(m_store.GetRotation(i))};
+      };
+      std::atomic<bool> moved{false};
+      m_pool.ParallelFor(m_store.size(), chunkSize, [&](size_t begin, size_t end) {
+         PROFILE_SCOPE("Step");
+         for (size_t i = begin; i < end; ++i)
+            snapshot.previous[i] = transform(i);
+         m_store.Step(dt, begin, end);
+         bool chunkMoved = false;
+         for (size_t i = begin; i < end; ++i)
+         {
+            snapshot.transforms[i] = transform(i);
+            chunkMoved = chunkMoved || snapshot.transforms[i] != snapshot.previous[i];
+         }
+         snapshot.chunkTicks[begin / chunkSize] = tick;
+         if (chunkMoved)
+            moved = true;
+      });
+
+      if (m_collisions)
+      {
+         PROFILE_SCOPE("Collide");
+         size_t contacts = 0;
+         m_grid.ForEachCandidate(m_store, [&](size_t i, size_t j) { contacts += m_store.Collide(i, j); });
+         m_contacts = contacts;
+      }
+
+      m_time += dt;
+      snapshot.tick = tick;
+      snapshot.time = m_time;
+      snapshot.dt = dt;
+      snapshot.moved = moved;
+      if (m_recorder)
+         m_recorder->WriteTick(tick, dt, snapshot.transforms);
+      m_snapshots.Publish();
+      if (moved)
+         SetEvent(m_published);
+   }
+
+   // Shows a recorded tick instead of a simulated one; the simulation thread must not be running.
+   void Replay(size_t tick, double dt, const std::vector<Transform>& previous, const std::vector<Transform>& transforms, double alpha)
+   {
+      auto& snapshot = m_snapshots.GetBack();
+      snapshot.previous = previous;
+      snapshot.transforms = transforms;
+      snapshot.chunkTicks.assign((transforms.size() + chunkSize - 1) / chunkSize, tick);
+      snapshot.tick = tick;
+      snapshot.dt = dt;
+      snapshot.moved = true;
+      m_snapshots.Publish();
+      m_snapshots.Acquire();
+      m_alpha = alpha;
+   }
+
+   // Every tick from now on goes to the recorder. Only while the simulation thread is stopped.
+   void SetRecorder(ReplayLog::Recorder* recorder) { m_recorder = recorder; }
+
+   // Render thread side. Takes the newest snapshot, if any, and works out how far the current
+   // moment lies between its two states. Rendering thus runs one tick behind the simulation.
+   // Returns whether the balls shown have changed, which a tick in which nothing moved does not,
+   // unless the frames before were still on their way to its state.
+   bool Acquire()
+   {
+      const bool wasMoving = IsMoving();
+      const bool acquired = m_snapshots.Acquire();
+      const auto& snapshot = GetSnapshot();
+      const double now = std::chrono::duration<double>(Clock::now() - m_epoch.load()).count();
+      m_alpha = snapshot.dt > 0 ? (std::min)(1.0, (std::max)(0.0, (now - snapshot.time) / snapshot.dt)) : 1;
+      return acquired && (snapshot.moved || wasMoving);
+   }
+
+   const Snapshot& GetSnapshot() const { return m_snapshots.GetFront(); }
+
+   // Whether the balls are still on their way to the state of the acquired snapshot.
+   bool IsMoving() const { return m_alpha < 1 && GetSnapshot().moved; }
+
+   double GetAlpha() const { return m_alpha; }
+
+   bool IsRunning() const { return m_running; }
+
+   // Signalled whenever a tick is published, for waiting on the next one along with messages.
+   HANDLE GetPublishedEvent() const { return m_published; }
+
+   Transform GetTransform(size_t i) const
+   {
+      const auto& snapshot = GetSnapshot();
+      const auto& from = snapshot.previous[i];
+      const auto& to = snapshot.transforms[i];
+      const auto lerp = [this](GLfloat a, GLfloat b) { return GLfloat(a + (b - a) * m_alpha); };
+      // Rotation only grows, so a smaller value means it has wrapped past 360
+      return {lerp(from[0], to[0]), lerp(from[1], to[1]), lerp(from[2], to[2]), lerp(from[3], to[3] < from[3] ? to[3] + 360 : to[3])};
+   }
+
+   size_t GetThreadCount() const { return m_pool.size(); }
+
+   // Only while the simulation thread is stopped.
+   void SetCollisions(bool collisions) { m_collisions = collisions; }
+
+   // Pairs of balls that bounced off each other in the last tick.
+   size_t GetContacts() const { return m_contacts; }
+
+private:
+   BallStore m_store;
+   WorkerPool m_pool;
+   TripleBuffer<Snapshot> m_snapshots;
+   double m_step = 1.0 / 120;
+   bool m_collisions = true;
+   SpatialHashGrid m_grid;
+   std::atomic<size_t> m_contacts{0};
+   size_t m_tick = 0;
+   double m_time = 0;
+   std::atomic<Clock::time_point> m_epoch{Clock::now()};
+   double m_alpha = 1;
+   ReplayLog::Recorder* m_recorder = nullptr;
+   std::atomic<bool> m_running{false};
+   HANDLE m_published;
+   std::thread m_thread;
+};
+
+class JumpingBall : public GLDisplayList
+{
+public:
+
+   explicit JumpingBall(const std::shared_ptr<BallSimulation>& simulation)
+      : m_simulation(simulation), m_index(simulation->GetStore().Add())
+   {
+   }
+
+   JumpingBall(const std::shared_ptr<BallSimulation>& simulation, double radius, const std::function<void()>& model)
+      : m_simulation(simulation), m_index(simulation->GetStore().Add(radius)), m_model(model)
+   {
+   }
+
+   JumpingBall(const std::shared_ptr<BallSimulation>& simulation, double radius, const std::shared_ptr<const PackedMesh>& model)
+      : GLDisplayList(model), m_simulation(simulation), m_index(simulation->GetStore().Add(radius)), m_model([model] { model->Draw(); })
+   {
+   }
+
+   void Draw() override { m_model(); }
+
+   void Transform() const override
+   {
+      const auto transform = m_simulation->GetTransform(m_index);
+      glTranslatef(transform[0], transform[1], transform[2]);
+      glRotatef(transform[3], 1, 1, 1);
+   }
+
+   bool GetBounds(BoundingSphere& bounds) const override
+   {
+      const auto transform = m_simulation->GetTransform(m_index);
+      bounds = {{transform[0], transform[1], transform[2]}, GLfloat(m_simulation->GetStore().GetRadius(m_index))};
+      return true;
+   }
+
+private:
+   std::shared_ptr<BallSimulation> m_simulation;
+   size_t m_index = 0;
+
+   std::function<void()> m_model = [this]{
+      const auto& store = m_simulation->GetStore();
+      glColor4ubv(store.GetColor(m_index).data());
+      quadricMeshes.Sphere(GLU_LINE, store.GetRadius(m_index), 16, 16)->Draw();
+   };
+};
+
+// Two cylinders, three wire spheres and a pair of wire rings, one colour each.
+void addGlobe(MeshBuilder& builder)
+{
+   builder.Color(0, 1, 0);
+   builder.SetTransform(multiply(rotation(90, 1, 0, 0.7f), translation(0.3f, 0, 0)));
+   builder.Add(*quadricMeshes.Cylinder(GLU_FILL, 0.1, 0.1, 0.2, 24, 1));
+   builder.Color(1, 0, 0);
+   builder.SetTransform(translation(0, 0, 0.2f));
+   builder.Add(*quadricMeshes.Cylinder(GLU_FILL, 0.1, 0.04, 0.2, 24, 1));
+   builder.Color(1, 1, 0);
+   builder.SetTransform(translation(0, 0, -0.2f));
+   builder.Add(*quadricMeshes.Sphere(GLU_LINE, 0.1, 16, 16));
+   builder.Color(0.5f, 0, 0.5f);
+   builder.SetTransform(translation(-0.3f, 0, 0));
+   builder.Add(*quadricMeshes.Sphere(GLU_LINE, 0.07, 16, 16));
+   builder.Color(1, 0, 0);
+   builder.Add(*quadricMeshes.Disk(GLU_LINE, 0.07, 0.15, 32, 1));
+   builder.SetTransform(multiply(translation(-0.3f, 0, 0), rotation(90, 1, 0, 0)));
+   builder.Add(*quadricMeshes.Disk(GLU_LINE, 0.07, 0.15, 32, 1));
+   builder.Color(0, 0, 1, 0.4f);
+   builder.SetTransform(rotation(90, 1, 0, 0));
+   builder.Add(*quadricMeshes.Sphere(GLU_LINE, 0.5, 32, 32));
+}
+
+// Balls are culled one by one, and each is drawn at the level of detail its size on screen asks
+// for: twice the given tessellation up close, down to a quarter of it for a few pixels.
+class JumpingBallBatch : public IGLObject
+{
+public:
+
+   static constexpr size_t levels = 4;
+
+   JumpingBallBatch(const std::shared_ptr<BallSimulation>& simulation, size_t begin, size_t end, double radius = 0.105, int slices = 16, int stacks = 16)
+      : m_simulation(simulation), m_begin(begin), m_end(end), m_radius(GLfloat(radius))
+   {
+      for (size_t level = 0; level < levels; ++level)
+      {
+         const auto scale = [level](int count) { return (std::max)(4, count * 2 >> level); };
+         m_meshes[level] = quadricMeshes.Sphere(GLU_LINE, radius, scale(slices), scale(stacks));
+      }
+   }
+
+   ~JumpingBallBatch()
+   {
+      for (auto&& [group, buffers] : m_buffers)
+      {
+         for (size_t level = 0; level < levels; ++level)
+         {
+            glResources.Release(GLResourceType::Buffer, buffers.vertices[level], group);
+            glResources.Release(GLResourceType::Buffer, buffers.indices[level], group);
+         }
+         glResources.Release(GLResourceType::Program, buffers.program, group);
+      }
+   }
+
+   size_t GetVersion() const override { return 0; }
+
+   void Draw() override { m_meshes[baseLevel]->Draw(); }
+   bool UsesList() const override { return !glExt; }
+
+   // Opaque, with the instancing program where there is one. Without bounds of its own the
+   // batch goes first among items of its state.
+   void Submit(const GLView&, std::vector<DrawItem>& items) const override
+   {
+      DrawItem item;
+      item.state.blend = false;
+      item.state.program = glExt ? getBuffers().program : 0;
+      items.push_back(item);
+   }
+
+   void Render(GLuint list, GLView& view, size_t) const override
+   {
+      const auto& store = m_simulation->GetStore();
+
+      // Instances are per view and per frame, so they come from client arrays of the render
+      // thread rather than buffers the windows of a share group would all be writing to.
+      thread_local std::array<std::vector<Instance>, levels> instances;
+      for (auto&& level : instances)
+         level.clear();
+      for (size_t i = m_begin; i < m_end; ++i)
+      {
+         const auto transform = m_simulation->GetTransform(i);
+         const BoundingSphere bounds{{transform[0], transform[1], transform[2]}, m_radius};
+         if (!view.IsVisible(bounds))
+         {
+            ++view.culled;
+            continue;
+         }
+         const auto& color = store.GetColor(i);
+         instances[getLevel(view, bounds)].push_back({
+            {transform[0], transform[1], transform[2], transform[3]},
+            {color[0], color[1], color[2], color[3]}});
+      }
+      for (size_t level = 0; level < levels; ++level)
+         view.triangles += instances[level].size() * m_meshes[level]->GetTriangles();
+
+      if (!glExt)
+      {
+         for (size_t level = 0; level < levels; ++level)
+         {
+            for (auto&& instance : instances[level])
+            {
+               glColor4ubv(instance.color);
+               glPushMatrix();
+               glTranslatef(instance.transform[0], instance.transform[1], instance.transform[2]);
+               glRotatef(instance.transform[3], 1, 1, 1);
+               if (level == baseLevel)
+                  glCallList(list);
+               else
+                  m_meshes[level]->Draw();
+               glPopMatrix();
+            }
+         }
+         return;
+      }
+
+      const auto& buffers = getBuffers();
+      for (GLuint i = 0; i < 3; ++i)
+         glExt.EnableVertexAttribArray(i);
+      glExt.VertexAttribDivisor(1, 1);
+      glExt.VertexAttribDivisor(2, 1);
+      for (size_t level = 0; level < levels; ++level)
+      {
+         if (instances[level].empty())
+            continue;
+
+         glExt.BindBuffer(GL_ARRAY_BUFFER, buffers.vertices[level]);
+         glExt.VertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(QuadricMesh::Vertex), reinterpret_cast<const void*>(offsetof(QuadricMesh::Vertex, position)));
+         glExt.BindBuffer(GL_ARRAY_BUFFER, 0);
+         glExt.VertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), instances[level].data()->transform);
+         glExt.VertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance), instances[level].data()->color);
+
+         const auto& mesh = *m_meshes[level];
+         glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indices[level]);
+         glExt.DrawElementsInstanced(mesh.GetMode(), GLsizei(mesh.GetIndices().size()), GL_UNSIGNED_SHORT, nullptr, GLsizei(instances[level].size()));
+      }
+      glExt.VertexAttribDivisor(1, 0);
+      glExt.VertexAttribDivisor(2, 0);
+      for (GLuint i = 0; i < 3; ++i)
+         glExt.DisableVertexAttribArray(i);
+      glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      glExt.BindBuffer(GL_ARRAY_BUFFER, 0);
+   }
+
+private:
+
+   // The tessellation the batch was asked for, which is also what the display list holds.
+   static constexpr size_t baseLevel = 1;
+
+   struct Instance
+   {
+      GLfloat transform[4];
+      GLubyte color[4];
+   };
+
+   struct Buffers
+   {
+      GLuint vertices[levels]{};
+      GLuint indices[levels]{};
+      GLuint program = 0;
+   };
+
+   // Radii in pixels at which a ball moves to a finer level.
+   static size_t getLevel(const GLView& view, const BoundingSphere& bounds)
+   {
+      if (!view.levelOfDetail)
+         return baseLevel;
+      const GLfloat pixels = view.GetPixelRadius(bounds);
+      return pixels >= 96 ? 0 : pixels >= 16 ? 1 : pixels >= 6 ? 2 : 3;
+   }
+
+   const Buffers& getBuffers() const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto& buffers = m_buffers[glResources.GetGroup()];
+      if (!buffers.program)
+      {
+         for (size_t level = 0; level < levels; ++level)
+         {
+            buffers.vertices[level] = glResources.Allocate(GLResourceType::Buffer);
+            buffers.indices[level] = glResources.Allocate(GLResourceType::Buffer);
+
+            glExt.BindBuffer(GL_ARRAY_BUFFER, buffers.vertices[level]);
+            const auto& vertices = m_meshes[level]->GetVertices();
+            glExt.BufferData(GL_ARRAY_BUFFER, GLsizeiptr(vertices.size() * sizeof(QuadricMesh::Vertex)), vertices.data(), GL_STATIC_DRAW);
+            glResources.SetBytes(GLResourceType::Buffer, buffers.vertices[level], vertices.size() * sizeof(QuadricMesh::Vertex));
+            glExt.BindBuffer(GL_ARRAY_BUFFER, 0);
+            glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indices[level]);
+            const auto& indices = m_meshes[level]->GetIndices();
+            glExt.BufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(indices.size() * sizeof(GLushort)), indices.data(), GL_STATIC_DRAW);
+            glResources.SetBytes(GLResourceType::Buffer, buffers.indices[level], indices.size() * sizeof(GLushort));
+            glExt.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+         }
+
+         buffers.program = createProgram();
+         glFinish();
+      }
+      return buffers;
+   }
+
+   static GLuint createProgram()
+   {
+      static const GLchar* const vertexShader = R"(
+         #version 130
+         in vec3 position;
+         in vec4 transform;
+         in vec4 color;
+         out vec4 instanceColor;
+         void main()
+         {
+            const vec3 axis = vec3(0.57735027);
+            float angle = radians(transform.w);
+            vec3 p = position * cos(angle) + cross(axis, position) * sin(angle) + axis * dot(axis, position) * (1.0 - cos(angle));
+            gl_Position = gl_ModelViewProjectionMatrix * vec4(p + transform.xyz, 1.0);
+            instanceColor = color;
+         }
+      )";
+      static const GLchar* const fragmentShader = R"(
+         #version 130
+         in vec4 instanceColor;
+         void main()
+         {
+            gl_FragColor = instanceColor;
+         }
+      )";
+
+      const auto compile = [](GLenum type, const GLchar* source) {
+         const GLuint shader = glExt.CreateShader(type);
+         glExt.ShaderSource(shader, 1, &source, nullptr);
+         glExt.CompileShader(shader);
+         GLint status = GL_FALSE;
+         glExt.GetShaderiv(shader, GL_COMPILE_STATUS, &status);
+         if (status != GL_TRUE)
+            logger.Write<LogLevel::Error>(LogCategory::Shader, "shader compilation failed", type);
+         return shader;
+      };
+
+      const GLuint program = glResources.Allocate(GLResourceType::Program);
+      const GLuint vertex = compile(GL_VERTEX_SHADER, vertexShader);
+      const GLuint fragment = compile(GL_FRAGMENT_SHADER, fragmentShader);
+      glExt.AttachShader(program, vertex);
+      glExt.AttachShader(program, fragment);
+      glExt.BindAttribLocation(program, 0, "position");
+      glExt.BindAttribLocation(program, 1, "transform");
+      glExt.BindAttribLocation(program, 2, "color");
+      glExt.LinkProgram(program);
+      glExt.DeleteShader(vertex);
+      glExt.DeleteShader(fragment);
+
+      GLint status = GL_FALSE;
+      glExt.GetProgramiv(program, GL_LINK_STATUS, &status);
+      if (status != GL_TRUE)
+         logger.Write<LogLevel::Error>(LogCategory::Shader, "shader program link failed");
+      return program;
+   }
+
+private:
+   std::shared_ptr<BallSimulation> m_simulation;
+   size_t m_begin = 0;
+   size_t m_end = 0;
+   GLfloat m_radius;
+   std::array<QuadricMeshCache::MeshPtr, levels> m_meshes;
+   mutable std::map<GLShareGroup, Buffers> m_buffers;
+   mutable std::mutex m_mutex;
+};
+
+struct Options
+{
+   size_t ballCount = 20;
+   double fps = 60;
+   bool vsync = false;
+   bool collisions = true;
+   int floorTiles = 8;
+   size_t views = 1;
+   bool profile = false;
+   bool onDemand = false;
+   std::string trace;
+   std::string log;
+   std::vector<std::string> textures;
+   GLsizei offscreenWidth = 0;
+   GLsizei offscreenHeight = 0;
+   std::string capture;
+   bool captureRaw = false;
+   size_t frameLimit = 0;
+   std::string record;
+   std::string replay;
+   bool lateLatch = false;
+   size_t meshCacheBytes = 0;
+};
+
+constexpr const char* usage =
+   "usage: msdnExample [ball count] [--fps <frames per second>] [--vsync] [--no-collisions] [--floor <tiles per side>]\n"
+   "   [--texture <bitmap path>]... [--views <windows>] [--profile] [--trace <json path>] [--log <path>]\n"
+   "   [--on-demand] [--offscreen <width>x<height>] [--capture <path prefix>] [--capture-raw] [--frames <count>]\n"
+   "   [--record <log path>] [--replay <log path>] [--late-latch] [--mesh-cache <kilobytes>]\n"
+   "--fps 0 leaves the pace to --vsync; without it, frames are drawn back to back at full CPU.\n"
+   "--mesh-cache evicts the least recently used quadric meshes beyond the given size; 0 keeps all.";
+
+// Clears valid and gives 0 for anything but digits, with a decimal point only if fraction is set.
+double parseNumber(const std::string& text, bool& valid, bool fraction = false)
+{
+   const bool digits = text.find_first_of("0123456789") != std::string::npos
+      && text.find_first_not_of(fraction ? "0123456789." : "0123456789") == std::string::npos;
+   valid &= digits;
+   return digits ? std::stod(text) : 0.0;
+}
+
+// Nothing for an option it does not know or a value that is not a number.
+std::optional<Options> parseOptions(int argc, char* argv[])
+{
+   Options options;
+   bool valid = true;
+   const auto number = [&valid](const std::string& text, bool fraction = false) {
+      return parseNumber(text, valid, fraction);
+   };
+   for (int i = 1; i < argc && valid; ++i)
+   {
+      const std::string arg = argv[i];
+      if (arg == "--fps" && i + 1 < argc)
+         options.fps = number(argv[++i], true);
+      else if (arg == "--vsync")
+         options.vsync = true;
+      else if (arg == "--no-collisions")
+         options.collisions = false;
+      else if (arg == "--floor" && i + 1 < argc)
+         options.floorTiles = int(number(argv[++i]));
+      else if (arg == "--texture" && i + 1 < argc)
+         options.textures.push_back(argv[++i]);
+      else if (arg == "--views" && i + 1 < argc)
+         options.views = (std::max)(size_t(1), size_t(number(argv[++i])));
+      else if (arg == "--profile")
+         options.profile = true;
+      else if (arg == "--on-demand")
+         options.onDemand = true;
+      else if (arg == "--offscreen" && i + 1 < argc)
+      {
+         const std::string size = argv[++i];
+         const size_t x = size.find('x');
+         options.offscreenWidth = GLsizei(number(size.substr(0, x)));
+         options.offscreenHeight = x == std::string::npos ? options.offscreenWidth : GLsizei(number(size.substr(x + 1)));
+      }
+      else if (arg == "--capture" && i + 1 < argc)
+         options.capture = argv[++i];
+      else if (arg == "--capture-raw")
+         options.captureRaw = true;
+      else if (arg == "--frames" && i + 1 < argc)
+         options.frameLimit = size_t(number(argv[++i]));
+      else if (arg == "--record" && i + 1 < argc)
+         options.record = argv[++i];
+      else if (arg == "--replay" && i + 1 < argc)
+         options.replay = argv[++i];
+      else if (arg == "--late-latch")
+         options.lateLatch = true;
+      else if (arg == "--mesh-cache" && i + 1 < argc)
+         options.meshCacheBytes = size_t(number(argv[++i])) * 1024;
+      else if (arg == "--trace" && i + 1 < argc)
+         options.trace = argv[++i];
+      else if (arg == "--log" && i + 1 < argc)
+         options.log = argv[++i];
+      else
+         options.ballCount = size_t(number(arg));
+   }
+   if (!valid)
+      return std::nullopt;
+   return options;
+}
+
+// Most balls a benchmark builds. At 10M, two stores or a store and its snapshots take 1.5 GB or
+// more, which a 32-bit process cannot allocate.
+constexpr size_t maxBenchBalls = sizeof(void*) < 8 ? 1000000 : 10000000;
+
+int benchPhysics()
+{
+   using Clock = std::chrono::steady_clock;
+   const double dt = 1.0 / 60;
+
+   for (size_t count = 1000; count <= maxBenchBalls; count *= 10)
+   {
+      BallStore scalar;
+      for (size_t i = 0; i < count; ++i)
+         scalar.Add();
+      BallStore simd = scalar;
+
+      const size_t ticks = (std::max)(size_t(10), size_t(100000000) / count);
+      const auto measure = [&](const std::function<void()>& step) {
+         const auto start = Clock::now();
+         for (size_t i = 0; i < ticks; ++i)
+            step();
+         const std::chrono::duration<double> elapsed = Clock::now() - start;
+         return double(count) * ticks / elapsed.count();
+      };
+      const double scalarRate = measure([&] { scalar.StepScalar(dt); });
+      const double simdRate = measure([&] { simd.Step(dt); });
+
+      double deviation = 0;
+      for (size_t i = 0; i < count; ++i)
+      {
+         deviation = (std::max)({deviation,
+            std::abs(scalar.GetX(i) - simd.GetX(i)),
+            std::abs(scalar.GetY(i) - simd.GetY(i)),
+            std::abs(scalar.GetZ(i) - simd.GetZ(i))});
+      }
+
+      std::cout << "balls: " << count << ", ticks: " << ticks
+         << ", scalar: " << scalarRate << " balls/s"
+         << ", simd: " << simdRate << " balls/s"
+         << ", max deviation: " << deviation << std::endl;
+   }
+   return 0;
+}
+
+int benchSimulation()
+{
+   using Clock = std::chrono::steady_clock;
+   const size_t hardwareThreads = (std::max)(1u, std::thread::hardware_concurrency());
+
+   for (size_t count = 100000; count <= maxBenchBalls; count *= 10)
+   {
+      for (size_t threads = 1; threads <= hardwareThreads; threads *= 2)
+      {
+         BallSimulation simulation(threads);
+         simulation.SetCollisions(false);
+         for (size_t i = 0; i < count; ++i)
+            simulation.GetStore().Add();
+
+         const size_t ticks = (std::max)(size_t(10), size_t(100000000) / count);
+         const auto start = Clock::now();
+         for (size_t i = 0; i < ticks; ++i)
+            simulation.Tick(1.0 / 60);
+         const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+         std::cout << "balls: " << count << ", threads: " << threads
+            << ", " << double(count) * ticks / elapsed.count() << " balls/s" << std::endl;
+      }
+   }
+   return 0;
+}
+
+// Reads snapshots on this thread while the simulation publishes them from its own, and checks
+// that every chunk of a snapshot comes from the same tick and that it does not change while held.
+// That catches torn snapshots in the data; it does not show the absence of data races.
+int checkSnapshots()
+{
+   // A million balls of the default size on the floor touch thousands of others each, and resolving
+   // those contacts would leave a tick or two in five seconds to check.
+   BallSimulation simulation;
+   simulation.SetCollisions(false);
+   for (size_t i = 0; i < 1000000; ++i)
+      simulation.GetStore().Add();
+   simulation.Start();
+
+   const auto checksum = [](const BallSimulation::Snapshot& snapshot) {
+      double sum = 0;
+      for (auto&& transform : snapshot.transforms)
+         sum += transform[0] + transform[1] + transform[2] + transform[3];
+      return sum;
+   };
+
+   size_t acquired = 0;
+   size_t torn = 0;
+   size_t lastTick = 0;
+   const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+   while (std::chrono::steady_clock::now() < end)
+   {
+      if (!simulation.Acquire())
+         continue;
+
+      const auto& snapshot = simulation.GetSnapshot();
+      const double before = checksum(snapshot);
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+      const bool consistent = snapshot.tick > lastTick
+         && std::all_of(snapshot.chunkTicks.begin(), snapshot.chunkTicks.end(), [&](size_t tick) { return tick == snapshot.tick; })
+         && checksum(snapshot) == before;
+      torn += !consistent;
+      lastTick = snapshot.tick;
+      ++acquired;
+   }
+   simulation.Stop();
+
+   std::cout << "snapshots acquired: " << acquired << ", torn: " << torn << std::endl;
+   return torn ? 1 : 0;
+}
+
+// Ball radius shrinks with the count so that the number of touching neighbours per ball stays
+// roughly the same; otherwise the contacts themselves, not the broadphase, would dominate.
+BallStore makeCollisionScene(size_t count)
+{
+   BallStore store;
+   const double radius = 0.15 * std::sqrt(36.0 / count);
+   for (size_t i = 0; i < count; ++i)
+      store.Add(radius);
+   store.Step(0);
+   return store;
+}
+
+// The scene main builds: three globes among balls of the default size.
+BallStore makeBallScene(size_t count)
+{
+   BallStore store;
+   for (size_t i = 0; i < 3; ++i)
+      store.Add(0.5);
+   for (size_t i = 0; i < count; ++i)
+      store.Add();
+   store.Step(0);
+   return store;
+}
+
+int benchCollisions()
+{
+   for (size_t count = 1000; count <= 1000000; count *= 10)
+   {
+      BallStore store = makeCollisionScene(count);
+      SpatialHashGrid grid;
+
+      const size_t ticks = (std::max)(size_t(5), size_t(10000000) / count);
+      size_t candidates = 0;
+      auto start = Clock::now();
+      for (size_t i = 0; i < ticks; ++i)
+         grid.ForEachCandidate(store, [&](size_t a, size_t b) { candidates += store.Overlaps(a, b); });
+      const double gridTime = std::chrono::duration<double>(Clock::now() - start).count() / ticks;
+
+      std::cout << "balls: " << count << ", grid: " << gridTime * 1000 << " ms/tick";
+      if (count <= 10000)
+      {
+         size_t overlaps = 0;
+         start = Clock::now();
+         for (size_t a = 0; a < count; ++a)
+         {
+            for (size_t b = a + 1; b < count; ++b)
+               overlaps += store.Overlaps(a, b);
+         }
+         const double pairTime = std::chrono::duration<double>(Clock::now() - start).count();
+         std::cout << ", pairwise: " << pairTime * 1000 << " ms/tick (" << overlaps << " overlaps)";
+      }
+      std::cout << ", overlaps/tick: " << candidates / ticks << std::endl;
+   }
+
+   for (size_t count = 100; count <= 10000; count *= 10)
+   {
+      BallStore store = makeBallScene(count);
+      SpatialHashGrid grid;
+
+      const size_t ticks = (std::max)(size_t(5), size_t(1000000) / count);
+      size_t tested = 0;
+      size_t overlaps = 0;
+      const auto start = Clock::now();
+      for (size_t i = 0; i < ticks; ++i)
+         grid.ForEachCandidate(store, [&](size_t a, size_t b) { ++tested; overlaps += store.Overlaps(a, b); });
+      const double gridTime = std::chrono::duration<double>(Clock::now() - start).count() / ticks;
+
+      // The same scene as a whole simulation tick: step, broadphase and the collisions resolved.
+      BallSimulation simulation(1);
+      simulation.GetStore() = makeBallScene(count);
+      size_t contacts = 0;
+      const auto tickStart = Clock::now();
+      for (size_t i = 0; i < ticks; ++i)
+      {
+         simulation.Tick(1.0 / 120);
+         contacts += simulation.GetContacts();
+      }
+      const double tickTime = std::chrono::duration<double>(Clock::now() - tickStart).count() / ticks;
+
+      std::cout << "globes: 3, balls: " << count << ", grid: " << gridTime * 1000 << " ms/tick, pairs tested/tick: " << tested / ticks
+         << " of " << (count + 3) * (count + 2) / 2 << ", overlaps/tick: " << overlaps / ticks
+         << "; simulation: " << tickTime * 1000 << " ms/tick, collisions/tick: " << double(contacts) / ticks << std::endl;
+   }
+   return 0;
+}
+
+int checkCollisions()
+{
+   size_t mismatches = 0;
+   for (size_t count : {size_t(2), size_t(23), size_t(1000), size_t(5000)})
+   {
+      for (size_t tick = 0; tick < 20; ++tick)
+      {
+         BallStore store = tick % 2 ? makeBallScene(count) : makeCollisionScene(count);
+         store.Step(tick / 2 * 0.1);
+         const size_t n = store.size();
+
+         std::vector<std::pair<size_t, size_t>> expected;
+         for (size_t a = 0; a < n; ++a)
+         {
+            for (size_t b = a + 1; b < n; ++b)
+            {
+               if (store.Overlaps(a, b))
+                  expected.emplace_back(a, b);
+            }
+         }
+
+         std::vector<std::pair<size_t, size_t>> found;
+         SpatialHashGrid grid;
+         grid.ForEachCandidate(store, [&](size_t a, size_t b) {
+            if (store.Overlaps(a, b))
+               found.emplace_back((std::min)(a, b), (std::max)(a, b));
+         });
+         std::sort(found.begin(), found.end());
+
+         mismatches += found != expected;
+      }
+   }
+
+   std::cout << "collision pair mismatches: " << mismatches << std::endl;
+   return mismatches ? 1 : 0;
+}
+
+// Highest working set between construction and Stop, less the working set at construction.
+// PeakWorkingSetSize cannot be reset, and the bitmap benchmark measures each load on its own, so a
+// thread samples WorkingSetSize every millisecond instead.
+class WorkingSetPeak
+{
+public:
+   WorkingSetPeak()
+      : m_base(workingSet())
+      , m_peak(m_base)
+      , m_thread([this] {
+         while (!m_stop)
+         {
+            sample();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+         }
+      })
+   {
+   }
+
+   WorkingSetPeak(const WorkingSetPeak&) = delete;
+
+   ~WorkingSetPeak() { Stop(); }
+
+   size_t Stop()
+   {
+      if (m_thread.joinable())
+      {
+         m_stop = true;
+         m_thread.join();
+         sample();
+      }
+      return m_peak - m_base;
+   }
+
+private:
+   static size_t workingSet()
+   {
+      PROCESS_MEMORY_COUNTERS counters{};
+      counters.cb = sizeof(counters);
+      return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? size_t(counters.WorkingSetSize) : 0;
+   }
+
+   void sample() { m_peak = (std::max)(m_peak.load(), workingSet()); }
+
+   const size_t m_base;
+   std::atomic<size_t> m_peak;
+   std::atomic<bool> m_stop{false};
+   std::thread m_thread;
+};
+
+void writeBitmap(const std::string& path, LONG width, LONG height, WORD bits, bool topDown)
+{
+   const size_t stride = (size_t(width) * bits / 8 + 3) & ~size_t(3);
+   BITMAPFILEHEADER fileHeader{};
+   BITMAPINFOHEADER infoHeader{};
+   fileHeader.bfType = 0x4D42;
+   fileHeader.bfOffBits = sizeof(fileHeader) + sizeof(infoHeader);
+   fileHeader.bfSize = DWORD(fileHeader.bfOffBits + stride * height);
+   infoHeader.biSize = sizeof(infoHeader);
+   infoHeader.biWidth = width;
+   infoHeader.biHeight = topDown ? -height : height;
+   infoHeader.biPlanes = 1;
+   infoHeader.biBitCount = bits;
+   infoHeader.biCompression = BI_RGB;
+
+   std::ofstream output(path, std::ios::binary);
+   output.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+   output.write(reinterpret_cast<const char*>(&infoHeader), sizeof(infoHeader));
+   std::vector<char> row(stride);
+   for (LONG y = 0; y < height; ++y)
+   {
+      for (size_t x = 0; x < stride; ++x)
+         row[x] = char(x ^ y);
+      output.write(row.data(), row.size());
+   }
+}
+
+// The loader GLTexture used before it mapped files, kept as the benchmark baseline.
+std::vector<char> loadBitmapByStream(const std::string& path)
+{
+   std::ifstream input(path, std::ios::binary);
+   std::istreambuf_iterator<char> it(input);
+   const auto extract = [&it](auto& t) {
+      for (size_t i = 0; i < sizeof(t); ++i)
+         reinterpret_cast<char*>(&t)[i] = *it++;
+   };
+
+   BITMAPFILEHEADER fileHeader{};
+   BITMAPINFOHEADER infoHeader{};
+   extract(fileHeader);
+   extract(infoHeader);
+   std::vector<char> data;
+   data.reserve(fileHeader.bfSize - fileHeader.bfOffBits);
+   std::copy(it, std::istreambuf_iterator<char>(), std::back_inserter(data));
+   return data;
+}
+
+int benchBitmaps()
+{
+   const auto touch = [](const byte* begin, const byte* end) {
+      size_t sum = 0;
+      for (const byte* p = begin; p < end; p += 64)
+         sum += *p;
+      return sum;
+   };
+   const auto ms = [](Clock::time_point start) {
+      return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+   };
+
+   const std::string path = "bench.bmp";
+   size_t checksum = 0;
+   for (LONG size : {4096, 8192, 16384})
+   {
+      for (auto [bits, topDown] : {std::pair<WORD, bool>{24, false}, std::pair<WORD, bool>{32, true}})
+      {
+         writeBitmap(path, size, size, bits, topDown);
+
+         auto start = Clock::now();
+         size_t streamPeak = 0;
+         {
+            WorkingSetPeak peak;
+            const auto data = loadBitmapByStream(path);
+            checksum += touch(reinterpret_cast<const byte*>(data.data()), reinterpret_cast<const byte*>(data.data() + data.size()));
+            streamPeak = peak.Stop();
+         }
+         const double streamTime = ms(start);
+
+         start = Clock::now();
+         double loadTime = 0;
+         bool mapped = false;
+         size_t mappedPeak = 0;
+         {
+            WorkingSetPeak peak;
+            const GLTexture texture(path);
+            loadTime = ms(start);
+            mapped = texture.IsMapped();
+            checksum += touch(texture.begin(), texture.end());
+            mappedPeak = peak.Stop();
+         }
+         const double mappedTime = ms(start);
+
+         std::cout << size << "x" << size << " " << bits << "-bit " << (topDown ? "top-down" : "bottom-up")
+            << ": stream " << streamTime << " ms, peak " << streamPeak / (1 << 20) << " MB"
+            << "; mapped " << loadTime << " ms load, " << mappedTime << " ms with read, peak " << mappedPeak / (1 << 20) << " MB"
+            << (mapped ? " (in place)" : " (converted)") << std::endl;
+      }
+   }
+   std::remove(path.c_str());
+   std::cout << "checksum: " << checksum << std::endl;
+   return 0;
+}
+
+// Decode plus upload time and resident size of each texture given on the command line, e.g. a
+// bitmap against its texconv output.
+int benchTextures(int argc, char* argv[])
+{
+   GLTestWindow window;
+   for (int i = 2; i < argc; ++i)
+   {
+      const std::string path = argv[i];
+      const size_t before = glResources.GetStats(GLResourceType::Texture).bytes;
+      const auto start = Clock::now();
+      window.AddTexture(path);
+      window.FlushTextures();
+      const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+      const size_t bytes = glResources.GetStats(GLResourceType::Texture).bytes - before;
+
+      std::ifstream file(path, std::ios::binary | std::ios::ate);
+      std::cout << std::dec << path << ": file " << size_t(file.tellg()) / 1024 << " KB, video memory " << bytes / 1024
+         << " KB, decode and upload " << ms << " ms" << std::endl;
+   }
+   return 0;
+}
+
+// Per-frame bookkeeping of GLTestWindow::Draw without the GL calls: lock every registered object
+// and compare its version, with a tenth of the objects expiring along the way.
+int benchObjects()
+{
+   for (size_t count : {size_t(1000), size_t(100000), size_t(1000000)})
+   {
+      std::vector<std::shared_ptr<IGLObject>> objects;
+      for (size_t i = 0; i < count; ++i)
+         objects.push_back(std::make_shared<GLDisplayList>());
+
+      std::map<GLuint, std::pair<size_t, std::weak_ptr<IGLObject>>> map;
+      GLObjectMap slots;
+      for (size_t i = 0; i < count; ++i)
+      {
+         map[GLuint(i + 1)] = {objects[i]->GetVersion(), objects[i]};
+         auto compiled = std::make_shared<GLCompiledList>();
+         compiled->list = GLuint(i + 1);
+         compiled->version = objects[i]->GetVersion();
+         slots.Add({compiled, objects[i]});
+      }
+      for (size_t i = 0; i < count; i += 10)
+         objects[i].reset();
+
+      const size_t frames = (std::max)(size_t(5), size_t(10000000) / count);
+      size_t visited = 0;
+
+      auto start = Clock::now();
+      for (size_t frame = 0; frame < frames; ++frame)
+      {
+         for (auto it = map.begin(); it != map.end(); )
+         {
+            if (const auto object = it->second.second.lock())
+            {
+               visited += it->second.first == object->GetVersion();
+               ++it;
+            }
+            else
+            {
+               it = map.erase(it);
+            }
+         }
+      }
+      const double mapTime = std::chrono::duration<double>(Clock::now() - start).count() / frames;
+
+      start = Clock::now();
+      for (size_t frame = 0; frame < frames; ++frame)
+      {
+         slots.ForEach([&](GLObjectMap::Handle handle, GLObjectEntry& entry) {
+            if (const auto object = entry.object.lock())
+               visited += entry.compiled->version == object->GetVersion();
+            else
+               slots.Remove(handle);
+         });
+      }
+      const double slotTime = std::chrono::duration<double>(Clock::now() - start).count() / frames;
+
+      std::cout << "objects: " << count << ", std::map: " << mapTime * 1000 << " ms/frame"
+         << ", slot map: " << slotTime * 1000 << " ms/frame (" << visited / frames << " visits)" << std::endl;
+   }
+   return 0;
+}
+
+// Invalidates the windows when the balls they show have changed: a tick moved them, or the frame
+// falls between two ticks.
+void invalidateMoved(BallSimulation& balls, const std::vector<std::unique_ptr<GLTestWindow>>& windows)
+{
+   if (balls.Acquire() || balls.IsMoving())
+   {
+      for (auto&& wnd : windows)
+         wnd->Invalidate();
+   }
+}
+
+// Runs the damage check of main's loop on an on-demand view and counts the frames it draws once
+// the scene has settled: none for a scene without balls, and none for balls paused as Space
+// pauses them, while balls that run keep it drawing.
+int checkIdle()
+{
+   const auto countFrames = [](size_t count, bool pause) {
+      const auto balls = std::make_shared<BallSimulation>();
+      for (size_t i = 0; i < count; ++i)
+         balls->GetStore().Add();
+      std::vector<std::unique_ptr<GLTestWindow>> windows;
+      windows.push_back(std::make_unique<GLTestWindow>());
+      auto& window = *windows.front();
+      window.Hide();
+      window.SetRenderOnDemand(true);
+      window.AddGLObject(std::make_shared<JumpingBallBatch>(balls, 0, count));
+      balls->Start();
+
+      size_t frames = 0;
+      const auto run = [&](std::chrono::milliseconds duration) {
+         frames = 0;
+         for (const auto end = Clock::now() + duration; Clock::now() < end; )
+         {
+            invalidateMoved(*balls, windows);
+            if (window.NeedsRedraw())
+            {
+               window.Draw(0);
+               ++frames;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+         }
+      };
+      run(std::chrono::milliseconds(100));
+      if (pause)
+         balls->Stop();
+      run(std::chrono::milliseconds(100));
+      run(std::chrono::milliseconds(500));
+      return frames;
+   };
+
+   const size_t empty = countFrames(0, false);
+   const size_t paused = countFrames(100, true);
+   const size_t running = countFrames(100, false);
+   std::cout << std::dec << "frames in 500 ms, no balls: " << empty << ", paused: " << paused << ", running: " << running << std::endl;
+   return !empty && !paused && running ? 0 : 1;
+}
+
+// Two views share a texture the first one requested. The first starts streaming it, a row per
+// frame, and is closed as Escape would close it; the second must take the upload over and end up
+// with the bitmap's pixels rather than the placeholder.
+int checkTextureHandoff()
+{
+   const std::string path = "Resources/tiles2.bmp";
+   GLTestWindow first;
+   GLTestWindow second;
+   first.Hide();
+   second.Hide();
+   first.SetUploadBudget(1);
+   const GLuint name = first.AddTexture(path);
+   const bool shared = second.AddTexture(path) == name;
+
+   const auto deadline = Clock::now() + std::chrono::seconds(10);
+   do
+   {
+      first.Draw(0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   while (!first.GetFrameStats().textureBytes && Clock::now() < deadline);
+   const size_t pending = first.GetFrameStats().pendingTextures;
+   first.ReplayInput(WM_KEYDOWN, VK_ESCAPE, 0);
+
+   size_t streamed = 0;
+   do
+   {
+      second.Draw(0);
+      streamed += second.GetFrameStats().textureBytes;
+   }
+   while (second.GetFrameStats().pendingTextures && Clock::now() < deadline);
+
+   const GLTexture expected(path);
+   const auto& level = expected.GetLevel(0);
+   std::vector<byte> pixels(level.size);
+   glBindTexture(GL_TEXTURE_2D, name);
+   glPixelStorei(GL_PACK_ALIGNMENT, 1);
+   glGetTexImage(GL_TEXTURE_2D, 0, expected.GetPixelFormat(), GL_UNSIGNED_BYTE, pixels.data());
+   glPixelStorei(GL_PACK_ALIGNMENT, 4);
+   glBindTexture(GL_TEXTURE_2D, 0);
+   const bool complete = std::equal(pixels.begin(), pixels.end(), expected.GetLevelData(0));
+
+   std::cout << std::dec << "shared name: " << (shared ? "yes" : "no") << ", pending when the first view closed: " << pending
+      << ", bytes the second view streamed: " << streamed << ", texture " << (complete ? "complete" : "incomplete") << std::endl;
+   return shared && pending && complete ? 0 : 1;
+}
+
+// Opens 1 to 8 hidden views of the same scene, once sharing one resource namespace and once with
+// a namespace per view, and reports the GL memory held after the first frames. Fails when the
+// shared case grows with the number of views.
+int checkSharedViews()
+{
+   struct Usage
+   {
+      size_t textures = 0;
+      size_t buffers = 0;
+      size_t lists = 0;
+   };
+
+   const auto measure = [](size_t views, bool share) {
+      const auto atlas = std::make_shared<TextureAtlas>("atlas", std::vector<GLTexture>{
+         GLTexture("Resources/tiles2.bmp"),
+         GLTexture("Resources/tiles3.bmp")
+      });
+      const auto balls = std::make_shared<BallSimulation>();
+      auto& store = balls->GetStore();
+      for (size_t i = 0; i < 100; ++i)
+         store.Add();
+      balls->Tick(0);
+      balls->Acquire();
+      const std::shared_ptr<IGLObject> glObjects[]{
+         std::make_shared<Floor>(*atlas, 0, 1),
+         std::make_shared<JumpingBallBatch>(balls, 0, store.size()),
+      };
+
+      GLTestWindow::ShareResources(share);
+      std::vector<std::unique_ptr<GLTestWindow>> windows;
+      for (size_t i = 0; i < views; ++i)
+      {
+         auto& wnd = *windows.emplace_back(std::make_unique<GLTestWindow>());
+         wnd.Hide();
+         wnd.AddTexture(atlas->GetKey(), [atlas] { return atlas->Build(); });
+         for (auto&& glObject : glObjects)
+            wnd.AddGLObject(glObject);
+      }
+      for (auto&& wnd : windows)
+      {
+         wnd->FlushTextures();
+         wnd->Draw(0);
+      }
+      GLTestWindow::ShareResources(true);
+
+      return Usage{
+         glResources.GetStats(GLResourceType::Texture).bytes,
+         glResources.GetStats(GLResourceType::Buffer).bytes,
+         glResources.GetStats(GLResourceType::DisplayList).live};
+   };
+
+   bool flat = true;
+   Usage first;
+   for (size_t views : {size_t(1), size_t(2), size_t(4), size_t(8)})
+   {
+      const Usage shared = measure(views, true);
+      const Usage separate = measure(views, false);
+      if (views == 1)
+         first = shared;
+      flat = flat && shared.textures <= first.textures && shared.buffers <= first.buffers && shared.lists <= first.lists;
+
+      std::cout << std::dec << "views: " << views
+         << ", shared: textures " << shared.textures / 1024 << " KB, buffers " << shared.buffers / 1024 << " KB, lists " << shared.lists
+         << ", separate: textures " << separate.textures / 1024 << " KB, buffers " << separate.buffers / 1024 << " KB, lists " << separate.lists
+         << std::endl;
+   }
+
+   std::cout << "shared resources " << (flat ? "stay flat" : "grow with the views") << std::endl;
+   return flat ? 0 : 1;
+}
+
+// Draws a ball batch in an offscreen view, then the same balls one display list call at a time as
+// JumpingBall used to, and checks that the two images match. With shaders and instancing the batch
+// takes the instanced path; without, both images come from the lists. The view is a hidden window
+// with a WGL context, so the check needs a Windows desktop session.
+int checkInstancing()
+{
+   const GLsizei size = 256;
+   const auto balls = std::make_shared<BallSimulation>();
+   auto& store = balls->GetStore();
+   for (size_t i = 0; i < 200; ++i)
+      store.Add();
+   balls->Tick(0);
+   balls->Acquire();
+   const auto batch = std::make_shared<JumpingBallBatch>(balls, 0, store.size());
+   const auto mesh = quadricMeshes.Sphere(GLU_LINE, 0.105, 16, 16);
+   const auto reference = std::make_shared<GLDisplayList>([balls, mesh] {
+      const auto& store = balls->GetStore();
+      glPushAttrib(GL_COLOR_BUFFER_BIT);
+      glDisable(GL_BLEND);
+      for (size_t i = 0; i < store.size(); ++i)
+      {
+         const auto transform = balls->GetTransform(i);
+         glColor4ubv(store.GetColor(i).data());
+         glPushMatrix();
+         glTranslatef(transform[0], transform[1], transform[2]);
+         glRotatef(transform[3], 1, 1, 1);
+         mesh->Draw();
+         glPopMatrix();
+      }
+      glPopAttrib();
+   });
+
+   GLTestWindow window;
+   window.Hide();
+   if (!window.SetOffscreen(size, size))
+      std::cout << "no framebuffer objects, reading the hidden window back" << std::endl;
+   window.SetLevelOfDetail(false);
+   std::cout << (glExt ? "instanced batch" : "no instancing, the batch draws its display list") << std::endl;
+
+   const auto render = [&](const std::shared_ptr<IGLObject>& glObject) {
+      const auto handle = window.AddGLObject(glObject);
+      window.Draw(0);
+      std::vector<GLubyte> pixels(size_t(size) * size * 4);
+      glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+      window.RemoveGLObject(handle);
+      return pixels;
+   };
+   const auto instanced = render(batch);
+   const auto expected = render(reference);
+
+   // The corner pixel is background; a few stray pixels are allowed where the two paths round
+   // differently.
+   size_t drawn = 0;
+   size_t differing = 0;
+   for (size_t i = 0; i < expected.size(); i += 4)
+   {
+      drawn += !std::equal(expected.begin() + i, expected.begin() + i + 3, expected.begin());
+      bool same = true;
+      for (size_t c = 0; c < 3; ++c)
+         same = same && std::abs(instanced[i + c] - expected[i + c]) <= 8;
+      differing += !same;
+   }
+
+   const bool match = drawn > expected.size() / 4 / 100 && differing * 50 <= drawn;
+   std::cout << std::dec << "balls: " << store.size() << ", pixels drawn: " << drawn << ", differing: " << differing << std::endl;
+   std::cout << "instanced batch " << (match ? "matches" : "does not match") << " the display lists" << std::endl;
+   return match ? 0 : 1;
+}
+
+// Draws 1 to 16 hidden views of the same scene one after another on this thread, then on a
+// render thread each, and reports the frames rendered per second over all views. Threads can only
+// beat the serial run with more than one hardware thread, hence the count printed first.
+int benchViews()
+{
+   const auto atlas = std::make_shared<TextureAtlas>("atlas", std::vector<GLTexture>{
+      GLTexture("Resources/tiles2.bmp"),
+      GLTexture("Resources/tiles3.bmp")
+   });
+   const auto balls = std::make_shared<BallSimulation>();
+   auto& store = balls->GetStore();
+   for (size_t i = 0; i < 200; ++i)
+      store.Add();
+   balls->Tick(0);
+   balls->Acquire();
+   const std::shared_ptr<IGLObject> glObjects[]{
+      std::make_shared<Floor>(*atlas, 0, 1),
+      std::make_shared<JumpingBallBatch>(balls, 0, store.size()),
+   };
+
+   const size_t frames = 20;
+   std::cout << std::dec << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+   for (size_t count : {size_t(1), size_t(2), size_t(4), size_t(8), size_t(16)})
+   {
+      std::vector<std::unique_ptr<GLTestWindow>> windows;
+      std::vector<GLTestWindow*> views;
+      for (size_t i = 0; i < count; ++i)
+      {
+         auto& wnd = *windows.emplace_back(std::make_unique<GLTestWindow>());
+         wnd.Hide();
+         wnd.SetSwapInterval(0);
+         wnd.AddTexture(atlas->GetKey(), [atlas] { return atlas->Build(); });
+         for (auto&& glObject : glObjects)
+            wnd.AddGLObject(glObject);
+         wnd.FlushTextures();
+         wnd.Draw(0);
+         views.push_back(&wnd);
+      }
+
+      auto start = Clock::now();
+      for (size_t frame = 0; frame < frames; ++frame)
+      {
+         for (auto&& wnd : windows)
+            wnd->Draw(0);
+      }
+      const double serial = std::chrono::duration<double>(Clock::now() - start).count();
+
+      double threaded = 0;
+      {
+         RenderThreads renderThreads(views);
+         start = Clock::now();
+         for (size_t frame = 0; frame < frames; ++frame)
+            renderThreads.Draw(0);
+         threaded = std::chrono::duration<double>(Clock::now() - start).count();
+      }
+
+      std::cout << std::dec << "views: " << count << ", one thread: " << frames * count / serial << " view frames/s"
+         << ", thread per view: " << frames * count / threaded << " view frames/s"
+         << " (" << serial / threaded << "x)" << std::endl;
+   }
+   return 0;
+}
+
+// Triangles drawn and time per frame with culling and level of detail off and on, the camera at
+// its default distance, where some balls fall outside the view, and far away.
+int benchLevelOfDetail()
+{
+   const auto balls = std::make_shared<BallSimulation>();
+   auto& store = balls->GetStore();
+   for (size_t i = 0; i < 2000; ++i)
+      store.Add();
+   balls->Tick(0);
+   balls->Acquire();
+   const auto batch = std::make_shared<JumpingBallBatch>(balls, 0, store.size());
+
+   GLTestWindow wnd;
+   wnd.Hide();
+   wnd.SetSwapInterval(0);
+   wnd.AddGLObject(batch);
+
+   const size_t frames = 20;
+   for (double distance : {4.0, 20.0})
+   {
+      for (bool enabled : {false, true})
+      {
+         wnd.SetViewDistance(distance);
+         wnd.SetCulling(enabled);
+         wnd.SetLevelOfDetail(enabled);
+         wnd.Draw(0);
+         glFinish();
+
+         size_t triangles = 0;
+         size_t culled = 0;
+         const auto start = Clock::now();
+         for (size_t frame = 0; frame < frames; ++frame)
+         {
+            wnd.Draw(0);
+            triangles += wnd.GetFrameStats().triangles;
+            culled += wnd.GetFrameStats().culledObjects;
+         }
+         glFinish();
+         const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / frames;
+         std::cout << std::dec << "distance " << distance << (enabled ? ", culling and lod" : ", everything")
+            << ": " << triangles / frames << " triangles, " << culled / frames << " culled, " << ms << " ms/frame" << std::endl;
+      }
+   }
+   return 0;
+}
 
-      case WM_LBUTTONDOWN:
-      case WM_MOUSEMOVE:
+// Vertices, bytes per vertex and post-transform cache misses per triangle (16-entry FIFO) of
+// the globe, a dense sphere and a grid of quads: as submitted, sized as the quadric meshes' float
+// position and normal arrays with misses counted once duplicates are merged, then packed with
+// float and with half positions.
+int benchMeshes()
+{
+   const std::pair<const char*, std::function<void(MeshBuilder&)>> meshes[]{
+      {"globe", addGlobe},
+      {"sphere 64x64", [](MeshBuilder& builder) {
+         builder.Add(*quadricMeshes.Sphere(GLU_FILL, 0.5, 64, 64));
+      }},
+      {"quads 64x64", [](MeshBuilder& builder) {
+         builder.Color(1, 1, 1);
+         builder.Begin(GL_QUADS);
+         for (int i = 0; i < 64; ++i)
          {
-            const int dragX = short(LOWORD(lParam));
-            const int dragY = short(HIWORD(lParam));
-            if (wParam & MK_LBUTTON)
+            for (int j = 0; j < 64; ++j)
             {
-               m_longinc = 0;
-               m_longitude = std::fmod(m_longitude + double(dragX - m_dragX) / 5, 360);
-               m_latitude = (std::min)(80.0, (std::max)(-80.0, m_latitude + double(dragY - m_dragY) / 5));
+               builder.Vertex(GLfloat(j), 0, GLfloat(i));
+               builder.Vertex(GLfloat(j), 0, GLfloat(i + 1));
+               builder.Vertex(GLfloat(j + 1), 0, GLfloat(i + 1));
+               builder.Vertex(GLfloat(j + 1), 0, GLfloat(i));
             }
-            m_dragX = dragX;
-            m_dragY = dragY;
          }
-         break;
+         builder.End();
+      }},
+   };
 
-      case WM_MOUSEWHEEL:
-         m_viewDistance = (std::min)(20.0, (std::max)(3.0, m_viewDistance - GET_WHEEL_DELTA_WPARAM(wParam) / double(WHEEL_DELTA)));
-         break;
+   for (auto&& [name, add] : meshes)
+   {
+      MeshBuilder builder;
+      add(builder);
+      const auto submitted = builder.Build(PackedMesh::Format::Float, false);
+      const size_t bytes = builder.GetVertexCount() * sizeof(QuadricMesh::Vertex) + builder.GetIndexCount() * sizeof(GLushort);
+      std::cout << std::dec << name << ", submitted: " << builder.GetVertexCount() << " vertices, " << sizeof(QuadricMesh::Vertex)
+         << " bytes/vertex, " << bytes << " bytes, " << submitted->GetCacheMissRatio() << " misses/triangle" << std::endl;
 
-      case WM_LBUTTONDBLCLK:
+      for (auto format : {PackedMesh::Format::Float, PackedMesh::Format::Half})
+      {
+         const auto start = Clock::now();
+         const auto mesh = builder.Build(format);
+         const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+         std::cout << std::dec << name << (format == PackedMesh::Format::Half ? ", half: " : ", float: ") << mesh->GetVertexCount()
+            << " vertices, " << mesh->GetStride() << " bytes/vertex, " << mesh->GetSize() << " bytes, "
+            << mesh->GetCacheMissRatio() << " misses/triangle, built in " << ms << " ms";
+         if (format == PackedMesh::Format::Half)
          {
-            WINDOWPLACEMENT wp {};
-            GetWindowPlacement(hwnd, &wp);
-            ShowWindow(hwnd, wp.showCmd == SW_MAXIMIZE ? SW_SHOWNORMAL : SW_SHOWMAXIMIZED);
+            double error = 0;
+            const auto reference = builder.Build(PackedMesh::Format::Float);
+            for (size_t i = 0; i < reference->GetVertexCount(); ++i)
+            {
+               GLfloat position[3];
+               reference->GetPosition(i, position);
+               for (GLfloat x : position)
+                  error = (std::max)(error, double(std::abs(fromHalf(toHalf(x)) - x)));
+            }
+            std::cout << ", max position error " << error;
          }
-         break;
+         std::cout << std::endl;
+      }
+   }
+   return 0;
+}
 
-      case WM_KEYDOWN:
-         switch (wParam)
-         {
-         case VK_ESCAPE:
-            DestroyWindow(hwnd);
-            break;
-         case VK_LEFT:
-            m_longinc -= 10.0;
-            break;
-         case VK_RIGHT:
-            m_longinc += 10.0;
-            break;
-         case VK_UP:
-            m_latitude = (std::min)(80.0, (std::max)(-80.0, m_latitude - 1));
-            break;
-         case VK_DOWN:
-            m_latitude = (std::min)(80.0, (std::max)(-80.0, m_latitude + 1));
-            break;
-         }
-         break;
+// Records ten seconds of simulation, a frame per tick, then replays the log and compares every
+// tick with what was simulated. Fails when an error exceeds the quantization.
+int checkReplay()
+{
+   const std::string path = "check.replay";
+   BallSimulation simulation(1);
+   for (size_t i = 0; i < 1000; ++i)
+      simulation.GetStore().Add();
 
-      default:
-         return DefWindowProc(hwnd, uMsg, wParam, lParam);
+   std::vector<std::vector<BallSimulation::Transform>> recorded;
+   size_t bytes = 0;
+   {
+      ReplayLog::Recorder recorder(path, simulation.GetStore());
+      simulation.SetRecorder(&recorder);
+      for (size_t tick = 0; tick < 1200; ++tick)
+      {
+         simulation.Tick(1.0 / 120);
+         simulation.Acquire();
+         recorded.push_back(simulation.GetSnapshot().transforms);
+         recorder.WriteFrame(simulation.GetSnapshot().tick, 0.5, {CameraState{-20, 10, 4}});
       }
-      return true;
+      simulation.SetRecorder(nullptr);
+      bytes = recorder.GetBytes();
    }
 
-private:
-   static WndClass m_wndClass;
-   HWND m_hwnd = nullptr;
-   HDC   m_hdc = nullptr;
-   HGLRC m_hrc = nullptr;
-   double m_viewDistance = 4;
-   double m_viewLevel = (floorLevel * 75 + topLevel * 0.25);
-   double m_latitude = 10.0;
-   double m_longitude = -20.0;
-   double m_latinc = 6.0;
-   double m_longinc = 2.5;
-   std::map<GLuint, std::pair<size_t, std::weak_ptr<IGLObject>>> m_glObjects;
-   int m_dragX = 0;
-   int m_dragY = 0;
-};
-
-GLTestWindow::WndClass GLTestWindow::m_wndClass;
+   size_t frames = 0;
+   double positionError = 0;
+   double rotationError = 0;
+   {
+      ReplayLog::Reader reader(path);
+      ReplayLog::Reader::Frame frame;
+      while (reader.Next(frame))
+      {
+         const auto& expected = recorded[frame.tick - 1];
+         for (size_t i = 0; i < expected.size(); ++i)
+         {
+            for (int k = 0; k < 3; ++k)
+               positionError = (std::max)(positionError, double(std::abs((*frame.transforms)[i][k] - expected[i][k])));
+            const double turn = std::fmod(std::abs((*frame.transforms)[i][3] - expected[i][3]), 360.0);
+            rotationError = (std::max)(rotationError, (std::min)(turn, 360 - turn));
+         }
+         ++frames;
+      }
+   }
+   std::remove(path.c_str());
 
-double rand() { return std::rand() / double(RAND_MAX);  }
+   const size_t raw = recorded.size() * recorded.front().size() * sizeof(BallSimulation::Transform);
+   std::cout << std::dec << "frames: " << frames << ", log " << bytes << " bytes (" << double(bytes) / recorded.size() / recorded.front().size()
+      << " bytes/ball/tick, " << double(raw) / bytes << "x smaller than raw floats)"
+      << ", max error: " << positionError << " position, " << rotationError << " degrees" << std::endl;
+   const bool ok = frames == recorded.size() && positionError <= 0.5 / ReplayLog::positionScale + 1e-5
+      && rotationError <= 0.5 / ReplayLog::rotationScale + 1e-3;
+   return ok ? 0 : 1;
+}
 
-class GLDisplayList : public IGLObject
+// Sustained frame rate of an offscreen window at 800x800 and 4K, drawing only and then with
+// every frame captured to PPM files, including the wait for the last file to be written.
+// The figures are those of whatever OpenGL driver the hidden window's pixel format selects.
+int benchCapture()
 {
-public:
+   const auto atlas = std::make_shared<TextureAtlas>("atlas", std::vector<GLTexture>{
+      GLTexture("Resources/tiles2.bmp"),
+      GLTexture("Resources/tiles3.bmp")
+   });
+   const auto balls = std::make_shared<BallSimulation>();
+   auto& store = balls->GetStore();
+   for (size_t i = 0; i < 200; ++i)
+      store.Add();
+   balls->Tick(0);
+   balls->Acquire();
+   const std::shared_ptr<IGLObject> glObjects[]{
+      std::make_shared<Floor>(*atlas, 0, 1),
+      std::make_shared<JumpingBallBatch>(balls, 0, store.size()),
+   };
 
-   GLDisplayList() = default;
-   explicit GLDisplayList(const std::function<void()>& draw) : m_draw(draw) {}
+   const std::string prefix = "bench_capture_";
+   for (auto [width, height, frames] : {std::tuple<GLsizei, GLsizei, size_t>{800, 800, 60}, {3840, 2160, 20}})
+   {
+      double fps[2]{};
+      FrameCapture::Stats stats;
+      for (bool capture : {false, true})
+      {
+         GLTestWindow wnd;
+         wnd.Hide();
+         wnd.SetSwapInterval(0);
+         if (!wnd.SetOffscreen(width, height))
+         {
+            std::cout << "no framebuffer objects" << std::endl;
+            return 1;
+         }
+         wnd.AddTexture(atlas->GetKey(), [atlas] { return atlas->Build(); });
+         for (auto&& glObject : glObjects)
+            wnd.AddGLObject(glObject);
+         wnd.FlushTextures();
+         wnd.Draw(0);
+         glFinish();
+         if (capture)
+            wnd.StartCapture(prefix, FrameCapture::Format::Ppm);
 
-   size_t GetVersion() const override { return m_version; }
-   void Draw() override { m_draw(); }
+         const auto start = Clock::now();
+         for (size_t frame = 0; frame < frames; ++frame)
+            wnd.Draw(0);
+         wnd.FinishCapture();
+         glFinish();
+         fps[capture] = frames / std::chrono::duration<double>(Clock::now() - start).count();
+         stats = wnd.GetCaptureStats();
+      }
 
-   void Reset(const std::function<void()>& draw)
-   {
-      m_draw = draw;
-      ++m_version;
+      for (size_t frame = 0; frame < stats.captured; ++frame)
+      {
+         std::ostringstream path;
+         path << prefix << std::setw(6) << std::setfill('0') << frame << ".ppm";
+         std::remove(path.str().c_str());
+      }
+      std::cout << std::dec << width << "x" << height << ": draw " << fps[0] << " frames/s, draw and capture " << fps[1] << " frames/s"
+         << " (" << stats.written << " frames, " << stats.dropped << " dropped, " << stats.bytes / double(1 << 20) * fps[1] / frames << " MB/s"
+         << ", writer stalls " << stats.stallSeconds * 1000 << " ms)" << std::endl;
    }
+   return 0;
+}
 
-private:
-   size_t m_version = 0;
-   std::function<void()> m_draw = []{};
-};
+constexpr const char* benchUsage = "usage: bench [--sizes <objects>,...] [--output <path>]";
 
-class JumpingBall : public GLDisplayList
+// bench [--sizes <objects>,...] [--output <path>], or msdnExample --bench-suite with the same options.
+// Simulation ticks, texture decode and upload, display list compiles and whole frames of a hidden
+// window, one JSON object per line so that runs of different builds can be compared by a script.
+// Options start at argv[first].
+int benchSuite(int argc, char* argv[], int first)
 {
-public:
+   std::vector<size_t> sizes{10, 1000, 10000};
+   std::string output;
+   bool valid = true;
+   for (int i = first; i < argc && valid; ++i)
+   {
+      const std::string arg = argv[i];
+      if (arg == "--sizes" && i + 1 < argc)
+      {
+         sizes.clear();
+         std::istringstream list(argv[++i]);
+         for (std::string size; std::getline(list, size, ','); )
+            sizes.push_back((std::min)(size_t(1000000), (std::max)(size_t(10), size_t(parseNumber(size, valid)))));
+         valid &= !sizes.empty();
+      }
+      else if (arg == "--output" && i + 1 < argc)
+         output = argv[++i];
+      else
+         valid = false;
+   }
+   if (!valid)
+   {
+      std::cout << benchUsage << std::endl;
+      return 1;
+   }
+   std::ofstream file;
+   if (!output.empty())
+   {
+      file.open(output);
+      if (!file)
+      {
+         std::cout << "cannot write " << output << std::endl;
+         return 1;
+      }
+   }
+   std::ostream& out = output.empty() ? std::cout : file;
 
-   JumpingBall() = default;
-   JumpingBall(double radius, const std::function<void()>& model) : m_radius(radius), m_model(model) {}
+   // Repeats f for at least a quarter of a second and reports the mean.
+   const auto measure = [&out](const char* name, size_t objects, const std::function<void()>& f) {
+      size_t iterations = 0;
+      const auto start = Clock::now();
+      auto elapsed = Clock::duration::zero();
+      do
+      {
+         f();
+         ++iterations;
+         elapsed = Clock::now() - start;
+      } while (elapsed < std::chrono::milliseconds(250));
+      const double ms = std::chrono::duration<double, std::milli>(elapsed).count() / iterations;
+      out << std::dec << "{\"benchmark\": \"" << name << "\", \"objects\": " << objects << ", \"iterations\": " << iterations
+         << ", \"ms\": " << ms << ", \"objects_per_second\": " << objects * 1000 / ms << "}" << std::endl;
+   };
 
-   void Calc(double dt)
-   {
-      m_t = std::fmod(m_t + dt, m_vy/5);
+   GLTestWindow window;
+   window.Hide();
+   window.SetSwapInterval(0);
 
-      m_y = floorLevel + m_radius + m_vy * m_t - 10 * m_t * m_t / 2;
-      m_rotation = std::fmod(m_rotation + 123 * dt, 360);
+   const std::string bitmap = "bench.bmp";
+   writeBitmap(bitmap, 512, 512, 24, false);
+   // Released after every load, so each one decodes and uploads into the same resource set.
+   measure("texture load", 1, [&] {
+      window.AddTexture("bench texture", [bitmap] { return GLTexture(bitmap); });
+      window.FlushTextures();
+      window.RemoveTexture("bench texture");
+   });
+   std::remove(bitmap.c_str());
 
-      m_x += m_vx * dt;
-      if (m_x < -3 + m_radius && m_vx < 0 || m_x > 3 - m_radius && m_vx > 0)
-         m_vx = -m_vx;
+   const GLuint list = glResources.Allocate(GLResourceType::DisplayList);
+   const auto sphere = quadricMeshes.Sphere(GLU_LINE, 0.105, 16, 16);
+   measure("list compile", 1, [&] {
+      GLList compiled(list, GL_COMPILE);
+      sphere->Draw();
+   });
+   glResources.Release(GLResourceType::DisplayList, list, glResources.GetGroup());
 
-      m_z += m_vz * dt;
-      if (m_z < -3 + m_radius && m_vz < 0 || m_z > 3 - m_radius && m_vz > 0)
-         m_vz = -m_vz;
+   const auto atlas = std::make_shared<TextureAtlas>("atlas", std::vector<GLTexture>{
+      GLTexture("Resources/tiles2.bmp"),
+      GLTexture("Resources/tiles3.bmp")
+   });
+   window.AddTexture(atlas->GetKey(), [atlas] { return atlas->Build(); });
+   window.FlushTextures();
+   const auto floor = std::make_shared<Floor>(*atlas, 0, 1);
+   const auto floorHandle = window.AddGLObject(floor);
 
-      Reset(createDisplayList());
+   for (size_t size : sizes)
+   {
+      const auto balls = std::make_shared<BallSimulation>();
+      auto& store = balls->GetStore();
+      for (size_t i = 0; i < size; ++i)
+         store.Add();
+      measure("simulation tick", size, [&] { balls->Tick(1.0 / 120); });
+      balls->Acquire();
+
+      const auto batch = std::make_shared<JumpingBallBatch>(balls, 0, size);
+      const auto handle = window.AddGLObject(batch);
+      window.Draw(0);
+      measure("draw", size, [&] {
+         window.Draw(0);
+         glFinish();
+      });
+      window.RemoveGLObject(handle);
    }
+   window.RemoveGLObject(floorHandle);
+   return 0;
+}
 
-private:
+// Cost of a scope with the profiler off and on, against an empty loop.
+int benchProfiler()
+{
+   const size_t count = 10000000;
+   volatile size_t sink = 0;
+   const auto run = [&] {
+      const auto start = Clock::now();
+      for (size_t i = 0; i < count; ++i)
+      {
+         PROFILE_SCOPE("Bench");
+         sink = sink + i;
+      }
+      return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / count;
+   };
 
-   std::function<void()> createDisplayList() const
-   {
-      return [this] {
-         glPushMatrix();
-         glTranslated(m_x, m_y, m_z);
-         glRotated(m_rotation, 1, 1, 1);
+   const auto start = Clock::now();
+   for (size_t i = 0; i < count; ++i)
+      sink = sink + i;
+   const double empty = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / count;
+   profiler.Enable(false);
+   const double disabled = run();
+   profiler.Enable(true);
+   const double enabled = run();
+   profiler.Enable(false);
 
-         m_model();
+   std::cout << "empty loop: " << empty << " ns, profiler disabled: " << disabled << " ns/scope"
+      << ", enabled: " << enabled << " ns/scope" << std::endl;
+   return 0;
+}
 
-         glPopMatrix();
-      };
+// Exports traces while another thread writes events into its ring as fast as it can, lapping it
+// many times over, and checks that every exported event is whole and follows the one before.
+int checkProfiler()
+{
+   const auto track = profiler.AddTrack("check");
+   std::atomic<bool> stop{false};
+   std::thread writer([&] {
+      for (int64_t i = 0; !stop; ++i)
+         track->Add("Check", i * 1000, i * 1000 + 1000);
+   });
+
+   const std::string path = "check_profiler.json";
+   size_t events = 0;
+   size_t broken = 0;
+   for (int pass = 0; pass < 50; ++pass)
+   {
+      profiler.WriteTrace(path);
+      std::ifstream input(path);
+      double last = -1;
+      for (std::string line; std::getline(input, line); )
+      {
+         if (line.find("\"name\":\"Check\"") == std::string::npos)
+            continue;
+         const double ts = std::stod(line.substr(line.find("\"ts\":") + 5));
+         const double dur = std::stod(line.substr(line.find("\"dur\":") + 6));
+         broken += dur != 1 || last >= 0 && ts != last + 1;
+         last = ts;
+         ++events;
+      }
    }
+   stop = true;
+   writer.join();
+   std::remove(path.c_str());
 
-private:
-   size_t m_version = 0;
-   double m_radius = 0.105;
-   double m_x = rand() * 4 - 2;
-   double m_y = 0;
-   double m_z = rand() * 4 - 2;
-   double m_rotation = 0;
-   double m_vx = rand() * 2 - 1;
-   double m_vy = rand() * 3 + 3;
-   double m_vz = rand() * 2 - 1;
-   double m_t = rand() * m_vy/5;
+   std::cout << std::dec << "events exported: " << events << ", torn or out of order: " << broken << std::endl;
+   return events && !broken ? 0 : 1;
+}
 
-   std::function<void()> m_model = [this, red = rand(), green = rand(), blue = rand()]{
-      QuadricPtr quadric(gluNewQuadric());
-      glColor4d(red, green, blue, 1);
-      gluQuadricDrawStyle(quadric.get(), GLU_LINE);
-      gluQuadricNormals(quadric.get(), GLU_SMOOTH);
-      gluSphere(quadric.get(), m_radius, 16, 16);
+// Cost of logging a window message from four threads at once: first under a rate limit, where
+// nearly all are dropped at the limit check, then without one, many times the queue's capacity,
+// so that the cost includes a full queue and the count of records it turned away.
+int benchLogger()
+{
+#if defined(_WIN32)
+   logger.SetOutput("NUL");
+#else
+   logger.SetOutput("/dev/null");
+#endif
+   const auto run = [](size_t perThread) {
+      std::vector<std::thread> threads;
+      const auto start = Clock::now();
+      for (size_t t = 0; t < 4; ++t)
+      {
+         threads.emplace_back([perThread] {
+            for (size_t i = 0; i < perThread; ++i)
+               logger.Write<LogLevel::Trace>(LogCategory::Window, "message", UINT(WM_MOUSEMOVE), WPARAM(i), LPARAM(i));
+         });
+      }
+      for (auto&& thread : threads)
+         thread.join();
+      return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (perThread * 4);
    };
-};
+
+   logger.SetRateLimit(LogCategory::Window, 100);
+   const double limited = run(1000000);
+   logger.SetRateLimit(LogCategory::Window, 0);
+   // Far more than the queue holds, so the sink has to keep up or records are dropped.
+   const size_t queuedPerThread = 100000;
+   const uint64_t overflowed = logger.GetOverflowed();
+   const double queued = run(queuedPerThread);
+   std::cout << "rate limited: " << limited << " ns/record, queued: " << queued << " ns/record"
+      << " (" << logger.GetOverflowed() - overflowed << " of " << queuedPerThread * 4 << " dropped, queue full)" << std::endl;
+   return 0;
+}
 
 } // namespace
 
-int main()
+int main(int argc, char* argv[])
 {
-   std::shared_ptr<IGLObject> glObjects[]{
-      std::make_shared<GLDisplayList>([] {
-         glBegin(GL_QUAD_STRIP);
-         
-         glColor3d(0.2, 0.2, 0.2);
-         glVertex3d(-3, floorLevel, -3);
-         glColor3d(0.2, 0.7, 0.2);
-         glVertex3d(-3, topLevel, -3);
-
-         glColor3d(0.2, 0.2, 0.7);
-         glVertex3d(-3, floorLevel, 3);
-         glColor3d(0.2, 0.7, 0.7);
-         glVertex3d(-3, topLevel, 3);
-
-         glColor3d(0.7, 0.2, 0.7);
-         glVertex3d(3, floorLevel, 3);
-         glColor3d(0.7, 0.7, 0.7);
-         glVertex3d(3, topLevel, 3);
-
-         glColor3d(0.2, 0.7, 0.7);
-         glVertex3d(3, floorLevel, -3);
-         glColor3d(0.2, 0.2, 0.7);
-         glVertex3d(3, topLevel, -3);
-
-         glColor3d(0.2, 0.2, 0.2);
-         glVertex3d(-3, floorLevel, -3);
-         glColor3d(0.2, 0.7, 0.2);
-         glVertex3d(-3, topLevel, -3);
-
-         glEnd();
-
-         {
-            const int m = 8;
-            const int n = 8;
-            const double tileBegin = 0;
-            const double tileEnd = 1;
-
-            for (int i = 0; i < m; ++i)
-            {
-               double z0 = -3 + 6.0 / m * i;
-               double z1 = z0 + 6.0 / m;
+#if defined(GLTEST_BENCH)
+   return benchSuite(argc, argv, 1);
+#endif
+   const std::string mode = argc > 1 ? argv[1] : "";
+   if (mode == "--bench-physics")
+      return benchPhysics();
+   if (mode == "--bench-simulation")
+      return benchSimulation();
+   if (mode == "--check-snapshots")
+      return checkSnapshots();
+   if (mode == "--bench-collisions")
+      return benchCollisions();
+   if (mode == "--check-collisions")
+      return checkCollisions();
+   if (mode == "--bench-objects")
+      return benchObjects();
+   if (mode == "--bench-bitmaps")
+      return benchBitmaps();
+   if (mode == "--bench-textures")
+      return benchTextures(argc, argv);
+   if (mode == "--check-shared-views")
+      return checkSharedViews();
+   if (mode == "--check-idle")
+      return checkIdle();
+   if (mode == "--check-texture-handoff")
+      return checkTextureHandoff();
+   if (mode == "--check-instancing")
+      return checkInstancing();
+   if (mode == "--bench-views")
+      return benchViews();
+   if (mode == "--bench-profiler")
+      return benchProfiler();
+   if (mode == "--check-profiler")
+      return checkProfiler();
+   if (mode == "--bench-logger")
+      return benchLogger();
+   if (mode == "--bench-lod")
+      return benchLevelOfDetail();
+   if (mode == "--bench-meshes")
+      return benchMeshes();
+   if (mode == "--bench-suite")
+      return benchSuite(argc, argv, 2);
+   if (mode == "--bench-capture")
+      return benchCapture();
+   if (mode == "--check-replay")
+      return checkReplay();
 
-               for (int j = 0; j < n; ++j)
-               {
+   const auto parsed = parseOptions(argc, argv);
+   if (!parsed)
+   {
+      std::cout << usage << std::endl;
+      return 1;
+   }
+   const Options& options = *parsed;
+   if (!options.log.empty() && !logger.SetOutput(options.log))
+      std::cout << "cannot write " << options.log << std::endl;
+   logger.SetRateLimit(LogCategory::Window, 100);
+   quadricMeshes.SetCapacity(options.meshCacheBytes);
+   const size_t ballCount = options.ballCount;
 
-                  double x0 = -3 + 6.0 / n * j;
-                  double x1 = x0 + 6.0 / n;
-
-                  glColor3d(1, 1, 1);
-                  if (i == 0 || i == m - 1 || j == 0 || j == n - 1)
-                  {
-                     glBindTexture(GL_TEXTURE_2D, 2);
-                  }
-                  else
-                  {
-                     glBindTexture(GL_TEXTURE_2D, 1);
-                  }
-
-                  glBegin(GL_QUADS);
-                  glVertex3d(x0, floorLevel, z0);
-                  glTexCoord2d(tileBegin, tileBegin);
-                  glVertex3d(x0, floorLevel, z1);
-                  glTexCoord2d(tileBegin, tileEnd);
-                  glVertex3d(x1, floorLevel, z1);
-                  glTexCoord2d(tileEnd, tileEnd);
-                  glVertex3d(x1, floorLevel, z0);
-                  glTexCoord2d(tileEnd, tileBegin);
-                  glEnd();
-                  glBindTexture(GL_TEXTURE_2D, 0);
-               }
-            }
-         }
+   const auto atlas = std::make_shared<TextureAtlas>("atlas", std::vector<GLTexture>{
+      GLTexture("Resources/tiles2.bmp"),
+      GLTexture("Resources/tiles3.bmp")
+   });
 
-      }),
+   std::shared_ptr<IGLObject> glObjects[]{
+      std::make_shared<Floor>(*atlas, 0, 1, options.floorTiles),
    };
 
-   GLTestWindow windows[] = {
-      glObjects,
-   };
+   std::vector<std::unique_ptr<GLTestWindow>> windows;
+   for (size_t i = 0; i < options.views; ++i)
+      windows.push_back(std::make_unique<GLTestWindow>());
 
-   std::vector<std::shared_ptr<JumpingBall>> balls;
+   const auto balls = std::make_shared<BallSimulation>();
 
-   const auto jumpingGlobe = [] {
-      {
-         QuadricPtr quadric(gluNewQuadric());
-         glColor4d(0, 1, 0, 1);
-         gluQuadricDrawStyle(quadric.get(), GLU_FILL);
-         gluQuadricNormals(quadric.get(), GLU_SMOOTH);
-         glPushMatrix();
-         glRotated(90.0, 1, 0, 0.7);
-         glTranslated(0.3, 0, 0);
-         gluCylinder(quadric.get(), 0.1, 0.1, 0.2, 24, 1);
-         glPopMatrix();
-      }
-      {
-         QuadricPtr quadric(gluNewQuadric());
-         glColor4d(1, 0, 0, 1);
-         gluQuadricDrawStyle(quadric.get(), GLU_FILL);
-         gluQuadricNormals(quadric.get(), GLU_SMOOTH);
-         glPushMatrix();
-         glTranslated(0, 0, 0.20);
-         gluCylinder(quadric.get(), 0.1, 0.04, 0.2, 24, 1);
-         glPopMatrix();
-      }
-      {
-         QuadricPtr quadric(gluNewQuadric());
-         glColor3d(1, 1, 0);
-         gluQuadricDrawStyle(quadric.get(), GLU_LINE);
-         gluQuadricNormals(quadric.get(), GLU_SMOOTH);
-         glPushMatrix();
-         glTranslated(0, 0, -0.20);
-         gluSphere(quadric.get(), 0.1, 16, 16);
-         glPopMatrix();
-      }
-      {
-         QuadricPtr quadric(gluNewQuadric());
-         gluQuadricDrawStyle(quadric.get(), GLU_LINE);
-         gluQuadricNormals(quadric.get(), GLU_SMOOTH);
-         glPushMatrix();
-         glTranslated(-0.3, 0, 0);
-         glColor3d(0.5, 0, 0.5);
-         gluSphere(quadric.get(), 0.07, 16, 16);
-         glColor3d(1, 0, 0);
-         gluDisk(quadric.get(), 0.07, 0.15, 32, 1);
-         glRotated(90, 1, 0, 0);
-         gluDisk(quadric.get(), 0.07, 0.15, 32, 1);
-         glPopMatrix();
-      }
-      {
-         QuadricPtr quadric(gluNewQuadric());
-         glColor4d(0, 0, 1, 0.4);
-         gluQuadricDrawStyle(quadric.get(), GLU_LINE);
-         gluQuadricNormals(quadric.get(), GLU_SMOOTH);
-         glPushMatrix();
-         glRotated(90.0, 1, 0, 0);
-         gluSphere(quadric.get(), 0.5, 32, 32);
-         glPopMatrix();
-      }
-   };
+   // Whether positions can be half floats is known once the windows above loaded the extensions.
+   MeshBuilder globeBuilder;
+   addGlobe(globeBuilder);
+   const auto globe = globeBuilder.Build(glExt && glExt.HasHalfFloatVertex() ? PackedMesh::Format::Half : PackedMesh::Format::Float);
 
+   std::vector<std::shared_ptr<IGLObject>> ballObjects;
    for (size_t i = 0; i < 3; ++i)
    {
-      balls.push_back(std::make_shared<JumpingBall>(0.5, jumpingGlobe));
+      ballObjects.push_back(std::make_shared<JumpingBall>(balls, 0.5, globe));
    }
 
-   for (size_t i = 0; i < 20; ++i)
    {
-      balls.push_back(std::make_shared<JumpingBall>());
+      auto& store = balls->GetStore();
+      const size_t begin = store.size();
+      for (size_t i = 0; i < ballCount; ++i)
+      {
+         store.Add();
+      }
+      ballObjects.push_back(std::make_shared<JumpingBallBatch>(balls, begin, store.size()));
    }
 
    {
-      GLTexture textures[]{
-         {1, "Resources/tiles2.bmp"},
-         {2, "Resources/tiles3.bmp"}
-      };
-
       for (auto&& wnd : windows)
       {
-         for (auto&& texture : textures)
+         wnd->AddTexture(atlas->GetKey(), [atlas] { return atlas->Build(); });
+         for (auto&& path : options.textures)
+         {
+            wnd->AddTexture(path);
+         }
+         for (auto&& glObject : glObjects)
          {
-            wnd.AddTexture(texture);
+            wnd->AddGLObject(glObject);
          }
-         for (auto&& ball : balls)
+         for (auto&& ballObject : ballObjects)
          {
-            wnd.AddGLObject(ball);
+            wnd->AddGLObject(ballObject);
          }
       }
    }
 
-   auto t0 = GetTickCount64();
+   // A replay needs the scene it was recorded with, i.e. the same ball count.
+   std::unique_ptr<ReplayLog::Reader> replay;
+   if (!options.replay.empty())
+   {
+      replay = std::make_unique<ReplayLog::Reader>(options.replay);
+      auto& store = balls->GetStore();
+      if (!*replay || replay->GetColors().size() != store.size())
+      {
+         std::cout << "cannot replay " << options.replay << (*replay ? ": recorded with a different ball count" : "") << std::endl;
+         return 1;
+      }
+      for (size_t i = 0; i < store.size(); ++i)
+         store.SetColor(i, replay->GetColors()[i]);
+   }
+   std::unique_ptr<ReplayLog::Recorder> recorder;
+   if (!options.record.empty())
+   {
+      recorder = std::make_unique<ReplayLog::Recorder>(options.record, balls->GetStore());
+      if (!*recorder)
+      {
+         std::cout << "cannot write " << options.record << std::endl;
+         return 1;
+      }
+      balls->SetRecorder(recorder.get());
+   }
+
+   std::vector<GLTestWindow*> views;
+   for (auto&& wnd : windows)
+   {
+      if (options.offscreenWidth > 0)
+      {
+         if (wnd->SetOffscreen(options.offscreenWidth, options.offscreenHeight))
+            wnd->Hide();
+         else
+            std::cout << "no framebuffer objects, drawing to the window" << std::endl;
+      }
+      if (!options.capture.empty())
+      {
+         const auto prefix = windows.size() > 1 ? options.capture + std::to_string(views.size()) + "_" : options.capture;
+         wnd->StartCapture(prefix, options.captureRaw ? FrameCapture::Format::Raw : FrameCapture::Format::Ppm);
+      }
+      wnd->SetSwapInterval(options.vsync ? 1 : 0);
+      wnd->ShowProfile(options.profile);
+      wnd->SetRenderOnDemand(options.onDemand);
+      wnd->SetLateLatch(options.lateLatch);
+      // Space pauses the balls, which lets a window drawing on demand go idle.
+      if (!replay)
+      {
+         wnd->SetKeyHandler([&balls](WPARAM key) {
+            if (key == VK_SPACE)
+               balls->IsRunning() ? balls->Stop() : balls->Start();
+         });
+      }
+      if (recorder)
+      {
+         wnd->SetInputHandler([&recorder, index = views.size()](UINT message, WPARAM wParam, LPARAM lParam) {
+            recorder->WriteInput(index, message, wParam, lParam);
+         });
+      }
+      views.push_back(wnd.get());
+   }
+   // The overlays of --profile hold the profiler on by themselves.
+   profiler.Enable(!options.trace.empty());
+   profiler.NameThread("main");
+   RenderThreads renderThreads(views);
+
+   balls->SetCollisions(options.collisions);
+   if (!replay)
+      balls->Start();
+
+   // The mouse moves the camera while the windows draw, which a late latch needs, and which gets
+   // each move stamped as it comes in either way. Only the drag and the wheel are taken then,
+   // which touch nothing but the camera. The keys and double clicks wait for the frame: Escape
+   // would pull a context from under its render thread, and maximizing resizes the window while
+   // Draw reads its size.
+   const auto pumpMouse = [] {
+      MSG msg{};
+      while (PeekMessage(&msg, nullptr, WM_MOUSEMOVE, WM_LBUTTONUP, PM_REMOVE)
+         || PeekMessage(&msg, nullptr, WM_MOUSEWHEEL, WM_MOUSEWHEEL, PM_REMOVE))
+      {
+         TranslateMessage(&msg);
+         DispatchMessage(&msg);
+      }
+   };
+
+   FramePacer pacer(options.vsync ? 0 : options.fps);
+   FrameTimeHistogram frameTimes;
+   FrameTimeHistogram inputLatencies;
+   auto t0 = Clock::now();
+   auto statsTime = t0;
+   auto statsCpu = processCpuSeconds();
+   size_t frames = 0;
+   size_t viewFrames = 0;
+   size_t totalFrames = 0;
+   std::vector<GLTestWindow*> redrawn;
+   ReplayLog::Reader::Frame replayFrame;
+   std::vector<CameraState> cameras;
+   size_t listCompiles = 0;
+   size_t triangles = 0;
+   size_t culledObjects = 0;
+   size_t stateChanges = 0;
+   size_t drawCalls = 0;
+   size_t reculls = 0;
+   size_t textureBytes = 0;
+   size_t pendingTextures = 0;
+   size_t spikes = 0;
+   double worstFrame = 0;
    for (;;)
    {
-      auto t1 = GetTickCount64();
-      const auto dt = double(t1 - t0) / 1000;
+      const bool due = pacer.Wait();
+
+      {
+         PROFILE_SCOPE("Messages");
+         for (MSG msg{}; PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE); )
+         {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+         }
+      }
+
+      if (!due)
+      {
+         continue;
+      }
+
+      const auto t1 = Clock::now();
+      const auto dt = std::chrono::duration<double>(t1 - t0).count();
 
-      for (auto&& ball : balls)
-         ball->Calc(dt);
+      if (replay)
+      {
+         if (!replay->Next(replayFrame))
+            break;
+         for (auto&& input : replayFrame.inputs)
+         {
+            if (input.window < windows.size() && *windows[input.window])
+               windows[input.window]->ReplayInput(input.message, input.wParam, input.lParam);
+         }
+         for (size_t i = 0; i < replayFrame.cameras.size() && i < windows.size(); ++i)
+            windows[i]->SetCamera(replayFrame.cameras[i]);
+         balls->Replay(replayFrame.tick, replayFrame.dt, *replayFrame.previous, *replayFrame.transforms, replayFrame.alpha);
+         for (auto&& wnd : windows)
+            wnd->Invalidate();
+      }
+      else
+      {
+         invalidateMoved(*balls, windows);
+      }
 
-      size_t wndCount = 0;
+      redrawn.clear();
       for (auto&& wnd : windows)
       {
-         if (wnd)
+         if (*wnd && wnd->NeedsRedraw())
+            redrawn.push_back(wnd.get());
+      }
+      if (redrawn.empty() && std::any_of(windows.begin(), windows.end(), [](auto&& wnd) { return bool(*wnd); }))
+      {
+         // Nothing has changed, and nothing will until a message comes in or, while the balls run,
+         // the simulation publishes a tick. The wait is no part of the next frame's time.
+         if (balls->IsRunning())
          {
-            wnd.Draw(dt);
-            ++wndCount;
+            const HANDLE published = balls->GetPublishedEvent();
+            MsgWaitForMultipleObjects(1, &published, FALSE, INFINITE, QS_ALLINPUT);
          }
+         else
+         {
+            WaitMessage();
+         }
+         t0 = Clock::now();
+         continue;
+      }
+
+      size_t drawn = 0;
+      {
+         PROFILE_SCOPE("Frame");
+         drawn = renderThreads.Draw(dt, pumpMouse);
       }
-      if (!wndCount)
+      profiler.EndFrame();
+      if (!drawn)
       {
          break;
       }
-      t0 = t1;
-      Sleep(1);
-
-      for (MSG msg{}; PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE); )
+      if (recorder)
       {
-         TranslateMessage(&msg);
-         DispatchMessage(&msg);
+         cameras.clear();
+         for (auto&& wnd : windows)
+            cameras.push_back(wnd->GetCamera());
+         recorder->WriteFrame(balls->GetSnapshot().tick, balls->GetAlpha(), cameras);
+      }
+      viewFrames += redrawn.size();
+      for (auto&& wnd : redrawn)
+      {
+         if (*wnd)
+         {
+            listCompiles += wnd->GetFrameStats().listCompiles;
+            triangles += wnd->GetFrameStats().triangles;
+            culledObjects += wnd->GetFrameStats().culledObjects;
+            stateChanges += wnd->GetFrameStats().stateChanges;
+            drawCalls += wnd->GetFrameStats().drawCalls;
+            reculls += wnd->GetFrameStats().reculls;
+            textureBytes += wnd->GetFrameStats().textureBytes;
+            pendingTextures = (std::max)(pendingTextures, wnd->GetFrameStats().pendingTextures);
+            for (auto&& latency : wnd->GetFrameStats().inputLatencies)
+               inputLatencies.Add(latency);
+         }
+      }
+      frameTimes.Add(dt);
+      ++frames;
+      ++totalFrames;
+      worstFrame = (std::max)(worstFrame, dt);
+      spikes += options.fps > 0 && dt > 1.5 / options.fps;
+      if (t1 - statsTime >= std::chrono::seconds(1))
+      {
+         const auto cpu = processCpuSeconds();
+         const auto elapsed = std::chrono::duration<double>(t1 - statsTime).count();
+         const auto meshStats = quadricMeshes.GetStats();
+         std::cout << std::dec << "\nlist compiles/frame: " << double(listCompiles) / frames
+            << ", mesh cache hits: " << meshStats.hits << ", misses: " << meshStats.misses
+            << ", evictions: " << meshStats.evictions << ", bytes: " << meshStats.bytes << std::endl;
+         std::cout << "triangles/view frame: " << double(triangles) / viewFrames
+            << ", culled objects/view frame: " << double(culledObjects) / viewFrames
+            << ", state changes/view frame: " << double(stateChanges) / viewFrames
+            << ", draw calls/view frame: " << double(drawCalls) / viewFrames << std::endl;
+         const auto listStats = glResources.GetStats(GLResourceType::DisplayList);
+         const auto textureStats = glResources.GetStats(GLResourceType::Texture);
+         const auto bufferStats = glResources.GetStats(GLResourceType::Buffer);
+         std::cout << "display lists: " << listStats.live << " (pooled " << listStats.pooled << ")"
+            << ", textures: " << textureStats.live << " (" << textureStats.bytes << " bytes)"
+            << ", buffers: " << bufferStats.live << " (" << bufferStats.bytes << " bytes)" << std::endl;
+         std::cout << "fps: " << frames / elapsed << ", view frames/s: " << viewFrames / elapsed
+            << ", frame time p50: " << frameTimes.GetPercentile(0.5) * 1000 << " ms"
+            << ", p99: " << frameTimes.GetPercentile(0.99) * 1000 << " ms"
+            << ", cpu: " << (cpu - statsCpu) / elapsed * 100 << "%" << std::endl;
+         if (inputLatencies.GetCount())
+         {
+            std::cout << "input to swap p50: " << inputLatencies.GetPercentile(0.5) * 1000 << " ms"
+               << ", p99: " << inputLatencies.GetPercentile(0.99) * 1000 << " ms"
+               << ", events: " << inputLatencies.GetCount();
+            if (options.lateLatch)
+               std::cout << ", reculled frames: " << reculls;
+            std::cout << std::endl;
+         }
+         if (profiler.IsEnabled())
+         {
+            std::cout << "profile (ms/frame):";
+            for (auto&& [name, ms] : profiler.GetAverages())
+               std::cout << " " << name << " " << ms;
+            std::cout << std::endl;
+         }
+         if (textureBytes || pendingTextures)
+         {
+            const auto textureStats = textureCache.GetStats();
+            std::cout << "streaming: " << pendingTextures << " textures pending, " << textureStats.pending << " decoding"
+               << ", uploaded " << textureBytes / double(1 << 20) << " MB"
+               << ", worst frame " << worstFrame * 1000 << " ms, spikes: " << spikes << std::endl;
+         }
+         if (!options.capture.empty())
+         {
+            const auto captureStats = windows.front()->GetCaptureStats();
+            std::cout << "capture: " << captureStats.captured << " frames read back, " << captureStats.written << " written, " << captureStats.dropped << " dropped"
+               << " (" << captureStats.bytes / double(1 << 20) << " MB), writer stalls " << captureStats.stallSeconds * 1000 << " ms" << std::endl;
+         }
+         statsTime = t1;
+         statsCpu = cpu;
+         frames = 0;
+         viewFrames = 0;
+         listCompiles = 0;
+         triangles = 0;
+         culledObjects = 0;
+         stateChanges = 0;
+         drawCalls = 0;
+         reculls = 0;
+         textureBytes = 0;
+         pendingTextures = 0;
+         spikes = 0;
+         worstFrame = 0;
+         frameTimes.Reset();
+         inputLatencies.Reset();
       }
+      t0 = t1;
+      if (options.frameLimit && totalFrames >= options.frameLimit)
+         break;
    }
-}
 
+   for (auto&& wnd : windows)
+      wnd->FinishCapture();
 
+   balls->Stop();
+   if (recorder)
+   {
+      balls->SetRecorder(nullptr);
+      std::cout << std::dec << "recorded " << recorder->GetTicks() << " ticks, " << recorder->GetBytes() << " bytes ("
+         << double(recorder->GetBytes()) / (std::max)(size_t(1), recorder->GetTicks()) << " bytes/tick)" << std::endl;
+   }
 
+   // The render threads are idle and the simulation has stopped. Decode threads may still be busy;
+   // with the profiler off they only finish the scopes already open, which the rings leave room for.
+   for (auto&& wnd : windows)
+      wnd->ShowProfile(false);
+   profiler.Enable(false);
+   if (!options.trace.empty() && !profiler.WriteTrace(options.trace))
+   {
+      std::cout << "cannot write " << options.trace << std::endl;
+   }
+}
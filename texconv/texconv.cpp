@@ -0,0 +1,116 @@
+#include "stdafx.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "TextureContainer.h"
+
+namespace
+{
+
+template <typename T>
+T read(const std::vector<char>& data, size_t offset)
+{
+   T t{};
+   std::memcpy(&t, data.data() + offset, sizeof(T));
+   return t;
+}
+
+// Uncompressed 8-bit palette, 24-bit and 32-bit bitmaps, either row order.
+bool loadBitmap(const std::string& path, TextureContainer::Image& image, bool& alpha)
+{
+   std::ifstream input(path, std::ios::binary);
+   const std::vector<char> data{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+   if (data.size() < 54 || data[0] != 'B' || data[1] != 'M')
+      return false;
+
+   const uint32_t offset = read<uint32_t>(data, 10);
+   const uint32_t headerSize = read<uint32_t>(data, 14);
+   const int32_t width = read<int32_t>(data, 18);
+   const int32_t height = read<int32_t>(data, 22);
+   const uint16_t bits = read<uint16_t>(data, 28);
+   const uint32_t compression = read<uint32_t>(data, 30);
+   const uint32_t colors = read<uint32_t>(data, 46);
+   if (width <= 0 || height == 0 || (bits != 8 && bits != 24 && bits != 32) || (compression != 0 && !(compression == 3 && bits == 32)))
+      return false;
+
+   const uint32_t rows = height < 0 ? uint32_t(-height) : uint32_t(height);
+   const size_t stride = (size_t(width) * bits / 8 + 3) & ~size_t(3);
+   if (offset > data.size() || (data.size() - offset) / stride < rows)
+      return false;
+
+   const size_t paletteOffset = 14 + headerSize;
+   const size_t paletteSize = colors ? (std::min)(colors, 256u) : 256;
+   if (bits == 8 && paletteOffset + paletteSize * 4 > offset)
+      return false;
+
+   // Alpha is only trusted from a header that carries an alpha mask.
+   alpha = bits == 32 && compression == 3 && headerSize > 40 && read<uint32_t>(data, 66) == 0xFF000000;
+
+   image.width = uint32_t(width);
+   image.height = rows;
+   image.pixels.resize(size_t(width) * rows * 4);
+   for (uint32_t y = 0; y < rows; ++y)
+   {
+      const uint8_t* source = reinterpret_cast<const uint8_t*>(data.data()) + offset + (height < 0 ? rows - 1 - y : y) * stride;
+      uint8_t* target = &image.pixels[size_t(y) * width * 4];
+      for (int32_t x = 0; x < width; ++x, target += 4)
+      {
+         const uint8_t* texel = bits == 8 ? reinterpret_cast<const uint8_t*>(data.data()) + paletteOffset + (std::min)(size_t(source[x]), paletteSize - 1) * 4
+            : source + x * bits / 8;
+         std::memcpy(target, texel, 3);
+         target[3] = alpha ? texel[3] : 255;
+      }
+   }
+   return true;
+}
+
+} // namespace
+
+// texconv <input.bmp> <output.gltc> [--bc1] [--no-mips]
+int main(int argc, char* argv[])
+{
+   if (argc < 3)
+   {
+      std::cout << "usage: texconv <input.bmp> <output.gltc> [--bc1] [--no-mips]" << std::endl;
+      return 1;
+   }
+
+   bool bc1 = false;
+   bool mips = true;
+   for (int i = 3; i < argc; ++i)
+   {
+      const std::string arg = argv[i];
+      if (arg == "--bc1")
+         bc1 = true;
+      else if (arg == "--no-mips")
+         mips = false;
+   }
+
+   TextureContainer::Image image;
+   bool alpha = false;
+   if (!loadBitmap(argv[1], image, alpha))
+   {
+      std::cout << "cannot read " << argv[1] << std::endl;
+      return 1;
+   }
+   if (bc1 && alpha)
+      std::cout << "warning: BC1 drops the alpha channel" << std::endl;
+
+   const auto format = bc1 ? TextureContainer::Format::BC1 : TextureContainer::Format::BGRA8;
+   if (!TextureContainer::Write(argv[2], image, format, mips, alpha))
+   {
+      std::cout << "cannot write " << argv[2] << std::endl;
+      return 1;
+   }
+
+   std::ifstream output(argv[2], std::ios::binary | std::ios::ate);
+   std::cout << argv[1] << " -> " << argv[2] << ": " << image.width << "x" << image.height
+      << (bc1 ? " BC1" : " BGRA8") << (mips ? " with mips" : "") << ", " << output.tellg() << " bytes" << std::endl;
+   return 0;
+}